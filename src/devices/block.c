@@ -1,9 +1,17 @@
 #include "devices/block.h"
 #include <list.h>
+#include <round.h>
 #include <string.h>
 #include <stdio.h>
 #include "devices/ide.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Maximum number of sectors of a transfer merged from several
+   requests, which is the size of the merge buffer. */
+#define MERGE_SECTORS 32
 
 /* A block device. */
 struct block
@@ -19,6 +27,16 @@ struct block
 
     unsigned long long read_cnt;        /* Number of sectors read. */
     unsigned long long write_cnt;       /* Number of sectors written. */
+
+    /* Request queue. */
+    struct lock queue_lock;             /* Protects queue. */
+    struct condition queue_cond;        /* Signaled when queue nonempty. */
+    struct list queue;                  /* Pending requests by sector. */
+    struct list held;                   /* Requests overlapping a pending
+                                           one, in submission order. */
+    block_sector_t head_pos;            /* Sector after the last transfer. */
+    uint8_t *merge_buffer;              /* MERGE_SECTORS sectors, allocated
+                                           on first merge. */
   };
 
 /* List of all block devices. */
@@ -28,6 +46,19 @@ static struct list all_blocks = LIST_INITIALIZER (all_blocks);
 static struct block *block_by_role[BLOCK_ROLE_CNT];
 
 static struct block *list_elem_to_block (struct list_elem *);
+static void transfer (struct block *, bool write, block_sector_t,
+                      size_t cnt, void *buffer);
+static void dispatcher (void *block_);
+static size_t next_requests (struct block *, struct list *requests);
+static void serve_requests (struct block *, struct list *requests,
+                            size_t cnt);
+static bool request_less (const struct list_elem *,
+                          const struct list_elem *, void *aux);
+static bool requests_conflict (const struct block_request *,
+                               const struct block_request *);
+static bool conflicts_before (struct list *, struct list_elem *end,
+                              const struct block_request *);
+static void release_held (struct block *);
 
 /* Returns a human-readable name for the given block device
    TYPE. */
@@ -131,9 +162,7 @@ verify_sector (struct block *block, block_sector_t sector)
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
-  check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  block_read_multiple (block, sector, 1, buffer);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -144,10 +173,328 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
 void
 block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
-  check_sector (block, sector);
-  ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  block_write_multiple (block, sector, 1, buffer);
+}
+
+/* Reads CNT contiguous sectors starting at SECTOR from BLOCK into
+   BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE bytes.
+   Drivers which support it transfer all sectors with a single
+   command.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_read_multiple (struct block *block, block_sector_t sector, size_t cnt,
+                     void *buffer)
+{
+  struct block_request request;
+
+  block_request_init (&request, false, sector, cnt, buffer, NULL, NULL);
+  block_submit (block, &request);
+  block_wait (&request);
+}
+
+/* Writes CNT contiguous sectors starting at SECTOR to BLOCK from
+   BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes.
+   Returns after the block device has acknowledged receiving the
+   data.  Drivers which support it transfer all sectors with a
+   single command.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_write_multiple (struct block *block, block_sector_t sector, size_t cnt,
+                      const void *buffer)
+{
+  struct block_request request;
+
+  block_request_init (&request, true, sector, cnt, (void *) buffer,
+                      NULL, NULL);
+  block_submit (block, &request);
+  block_wait (&request);
+}
+
+/* Initializes REQUEST to transfer CNT sectors starting at SECTOR
+   between a block device and BUFFER, to the device if WRITE is
+   true.  If DONE is non-null, it is called with REQUEST and AUX on
+   completion, otherwise block_wait() waits for completion. */
+void
+block_request_init (struct block_request *request, bool write,
+                    block_sector_t sector, size_t cnt, void *buffer,
+                    block_request_func *done, void *aux)
+{
+  ASSERT (cnt > 0);
+
+  request->write = write;
+  request->sector = sector;
+  request->cnt = cnt;
+  request->buffer = buffer;
+  request->done = done;
+  request->aux = aux;
+  sema_init (&request->completion, 0);
+}
+
+/* Queues REQUEST on BLOCK and returns without waiting for it.
+   A request overlapping a pending one is held back until the
+   pending one is taken off the queue, see release_held(). */
+void
+block_submit (struct block *block, struct block_request *request)
+{
+  check_sector (block, request->sector);
+  check_sector (block, request->sector + request->cnt - 1);
+  ASSERT (!request->write || block->type != BLOCK_FOREIGN);
+
+  lock_acquire (&block->queue_lock);
+  if (block->ops->submit != NULL)
+    {
+      /* The sectors are counted here, they are transferred by the
+         device BLOCK is part of. */
+      if (request->write)
+        block->write_cnt += request->cnt;
+      else
+        block->read_cnt += request->cnt;
+      lock_release (&block->queue_lock);
+      block->ops->submit (block->aux, request);
+      return;
+    }
+
+  if (conflicts_before (&block->queue, list_end (&block->queue), request)
+      || conflicts_before (&block->held, list_end (&block->held), request))
+    list_push_back (&block->held, &request->elem);
+  else
+    {
+      list_insert_ordered (&block->queue, &request->elem, request_less,
+                           NULL);
+      cond_signal (&block->queue_cond, &block->queue_lock);
+    }
+  lock_release (&block->queue_lock);
+}
+
+/* Waits until REQUEST, which must have been submitted without a
+   completion function, is complete. */
+void
+block_wait (struct block_request *request)
+{
+  ASSERT (request->done == NULL);
+  sema_down (&request->completion);
+}
+
+/* Transfers CNT sectors starting at SECTOR between BLOCK and
+   BUFFER with the driver's operations. */
+static void
+transfer (struct block *block, bool write, block_sector_t sector,
+          size_t cnt, void *buffer_)
+{
+  uint8_t *buffer = buffer_;
+  size_t i;
+
+  if (write)
+    {
+      if (block->ops->write_multiple != NULL)
+        block->ops->write_multiple (block->aux, sector, cnt, buffer);
+      else
+        for (i = 0; i < cnt; i++)
+          block->ops->write (block->aux, sector + i,
+                             buffer + i * BLOCK_SECTOR_SIZE);
+      block->write_cnt += cnt;
+    }
+  else
+    {
+      if (block->ops->read_multiple != NULL)
+        block->ops->read_multiple (block->aux, sector, cnt, buffer);
+      else
+        for (i = 0; i < cnt; i++)
+          block->ops->read (block->aux, sector + i,
+                            buffer + i * BLOCK_SECTOR_SIZE);
+      block->read_cnt += cnt;
+    }
+}
+
+/* Thread function serving the requests queued on BLOCK. */
+static void
+dispatcher (void *block_)
+{
+  struct block *block = block_;
+
+  for (;;)
+    {
+      struct list requests;
+      size_t cnt;
+
+      list_init (&requests);
+      lock_acquire (&block->queue_lock);
+      while (list_empty (&block->queue))
+        cond_wait (&block->queue_cond, &block->queue_lock);
+      cnt = next_requests (block, &requests);
+      release_held (block);
+      lock_release (&block->queue_lock);
+
+      serve_requests (block, &requests, cnt);
+    }
+}
+
+/* Moves the next request in C-LOOK order from BLOCK's queue to
+   REQUESTS, followed by the queued requests for the adjacent
+   sectors in the same direction that fit into one merged
+   transfer.  Returns the total number of sectors.  BLOCK's queue
+   must be locked and nonempty. */
+static size_t
+next_requests (struct block *block, struct list *requests)
+{
+  struct list_elem *e;
+  struct block_request *first;
+  block_sector_t end;
+  size_t cnt;
+
+  /* The first request at or after the disk head, or the lowest one
+     if there is none. */
+  for (e = list_begin (&block->queue); e != list_end (&block->queue);
+       e = list_next (e))
+    if (list_entry (e, struct block_request, elem)->sector >= block->head_pos)
+      break;
+  if (e == list_end (&block->queue))
+    e = list_begin (&block->queue);
+
+  first = list_entry (e, struct block_request, elem);
+  e = list_remove (e);
+  list_push_back (requests, &first->elem);
+  end = first->sector + first->cnt;
+  cnt = first->cnt;
+
+  while (e != list_end (&block->queue))
+    {
+      struct block_request *r = list_entry (e, struct block_request, elem);
+      if (r->sector != end || r->write != first->write
+          || cnt + r->cnt > MERGE_SECTORS)
+        break;
+      e = list_remove (e);
+      list_push_back (requests, &r->elem);
+      end += r->cnt;
+      cnt += r->cnt;
+    }
+
+  block->head_pos = end;
+  return cnt;
+}
+
+/* Transfers the CNT sectors of the adjacent REQUESTS of BLOCK and
+   completes them.  More than one request is transferred at once
+   through BLOCK's merge buffer. */
+static void
+serve_requests (struct block *block, struct list *requests, size_t cnt)
+{
+  struct block_request *first
+    = list_entry (list_front (requests), struct block_request, elem);
+  bool write = first->write;
+  struct list_elem *e;
+
+  if (list_size (requests) > 1 && block->merge_buffer == NULL)
+    block->merge_buffer
+      = palloc_get_multiple (0, DIV_ROUND_UP (MERGE_SECTORS
+                                              * BLOCK_SECTOR_SIZE, PGSIZE));
+
+  if (list_size (requests) == 1 || block->merge_buffer == NULL)
+    for (e = list_begin (requests); e != list_end (requests);
+         e = list_next (e))
+      {
+        struct block_request *r = list_entry (e, struct block_request, elem);
+        transfer (block, write, r->sector, r->cnt, r->buffer);
+      }
+  else
+    {
+      uint8_t *buffer = block->merge_buffer;
+
+      if (write)
+        for (e = list_begin (requests); e != list_end (requests);
+             e = list_next (e))
+          {
+            struct block_request *r
+              = list_entry (e, struct block_request, elem);
+            memcpy (buffer, r->buffer, r->cnt * BLOCK_SECTOR_SIZE);
+            buffer += r->cnt * BLOCK_SECTOR_SIZE;
+          }
+      transfer (block, write, first->sector, cnt, block->merge_buffer);
+      if (!write)
+        for (e = list_begin (requests); e != list_end (requests);
+             e = list_next (e))
+          {
+            struct block_request *r
+              = list_entry (e, struct block_request, elem);
+            memcpy (r->buffer, buffer, r->cnt * BLOCK_SECTOR_SIZE);
+            buffer += r->cnt * BLOCK_SECTOR_SIZE;
+          }
+    }
+
+  /* A completed request may be freed by its owner right away. */
+  while (!list_empty (requests))
+    {
+      struct block_request *r
+        = list_entry (list_pop_front (requests), struct block_request, elem);
+      if (r->done != NULL)
+        r->done (r, r->aux);
+      else
+        sema_up (&r->completion);
+    }
+}
+
+/* Moves the requests held back on BLOCK which no longer overlap a
+   queued request or an earlier held one to the queue.  The
+   requests just taken off the queue are served first by the
+   device's thread, so a released request still follows them.
+   BLOCK's queue must be locked. */
+static void
+release_held (struct block *block)
+{
+  struct list_elem *e = list_begin (&block->held);
+
+  while (e != list_end (&block->held))
+    {
+      struct block_request *r = list_entry (e, struct block_request, elem);
+      if (conflicts_before (&block->queue, list_end (&block->queue), r)
+          || conflicts_before (&block->held, e, r))
+        e = list_next (e);
+      else
+        {
+          e = list_remove (e);
+          list_insert_ordered (&block->queue, &r->elem, request_less, NULL);
+        }
+    }
+}
+
+/* Returns true if one of the requests in LIST before END
+   conflicts with REQUEST. */
+static bool
+conflicts_before (struct list *list, struct list_elem *end,
+                  const struct block_request *request)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (list); e != end; e = list_next (e))
+    if (requests_conflict (list_entry (e, struct block_request, elem),
+                           request))
+      return true;
+  return false;
+}
+
+/* Returns true if A and B share a sector and at least one of them
+   writes it, so that their order matters. */
+static bool
+requests_conflict (const struct block_request *a,
+                   const struct block_request *b)
+{
+  return (a->write || b->write)
+         && a->sector < b->sector + b->cnt
+         && b->sector < a->sector + a->cnt;
+}
+
+/* Orders requests by sector.  Requests for the same sector keep
+   their submission order. */
+static bool
+request_less (const struct list_elem *a_, const struct list_elem *b_,
+              void *aux UNUSED)
+{
+  const struct block_request *a = list_entry (a_, struct block_request, elem);
+  const struct block_request *b = list_entry (b_, struct block_request, elem);
+
+  return a->sector < b->sector;
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -171,6 +518,13 @@ block_type (struct block *block)
   return block->type;
 }
 
+/* Returns the number of sectors read from BLOCK so far. */
+unsigned long long
+block_read_cnt (struct block *block)
+{
+  return block->read_cnt;
+}
+
 /* Prints statistics for each block device used for a Pintos role. */
 void
 block_print_stats (void)
@@ -211,6 +565,12 @@ block_register (const char *name, enum block_type type,
   block->aux = aux;
   block->read_cnt = 0;
   block->write_cnt = 0;
+  lock_init (&block->queue_lock);
+  cond_init (&block->queue_cond);
+  list_init (&block->queue);
+  list_init (&block->held);
+  block->head_pos = 0;
+  block->merge_buffer = NULL;
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
@@ -219,6 +579,9 @@ block_register (const char *name, enum block_type type,
     printf (", %s", extra_info);
   printf ("\n");
 
+  if (ops->submit == NULL)
+    thread_create (name, PRI_DEFAULT, dispatcher, block);
+
   return block;
 }
 
@@ -1,10 +1,11 @@
 #ifndef DEVICES_BLOCK_H
 #define DEVICES_BLOCK_H
 
-#include <stddef.h>
 #include <stddef.h>
 #include <stdbool.h>
 #include <inttypes.h>
+#include <list.h>
+#include "threads/synch.h"
 
 /* Size of a block device sector in bytes.
    All IDE disks use this sector size, as do most USB and SCSI
@@ -55,10 +56,56 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multiple (struct block *, block_sector_t, size_t cnt,
+                          void *);
+void block_write_multiple (struct block *, block_sector_t, size_t cnt,
+                           const void *);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
+/* Asynchronous requests.
+
+   Each block device queues the requests submitted to it and
+   serves them in a separate thread, in C-LOOK order: ascending by
+   sector from the last position of the disk head, wrapping around
+   to the lowest pending sector.  Pending requests for adjacent
+   sectors in the same direction are merged into one transfer.
+   A request overlapping a pending one, where either of them
+   writes, is held back until that one is complete, so that
+   overlapping requests take effect in submission order.
+   The synchronous functions above submit a request and wait for
+   it, so they are ordered together with asynchronous requests.
+   A partition has no queue of its own, its requests are queued on
+   the disk it is part of. */
+
+struct block_request;
+
+/* Called by the device's thread when REQUEST is complete.  Must not
+   wait for other requests to the same device. */
+typedef void block_request_func (struct block_request *request, void *aux);
+
+/* A request to transfer CNT contiguous sectors.  Owned by the
+   submitter and must stay valid until it completes. */
+struct block_request
+  {
+    struct list_elem elem;              /* Element in device queue. */
+    bool write;                         /* Write to the device? */
+    block_sector_t sector;              /* First sector. */
+    size_t cnt;                         /* Number of sectors. */
+    void *buffer;                       /* CNT * BLOCK_SECTOR_SIZE bytes. */
+    block_request_func *done;           /* Completion function or null. */
+    void *aux;                          /* Passed to DONE. */
+    struct semaphore completion;        /* Up'd on completion if no DONE. */
+  };
+
+void block_request_init (struct block_request *, bool write,
+                         block_sector_t, size_t cnt, void *buffer,
+                         block_request_func *done, void *aux);
+void block_submit (struct block *, struct block_request *);
+void block_wait (struct block_request *);
+
 /* Statistics. */
+unsigned long long block_read_cnt (struct block *);
 void block_print_stats (void);
 
 /* Lower-level interface to block device drivers. */
@@ -67,6 +114,18 @@ struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+
+    /* Transfer CNT contiguous sectors at once.  Optional, if null
+       the sectors are transferred one by one. */
+    void (*read_multiple) (void *aux, block_sector_t, size_t cnt,
+                           void *buffer);
+    void (*write_multiple) (void *aux, block_sector_t, size_t cnt,
+                            const void *buffer);
+
+    /* Passes a request on to the device the block device is part
+       of, with its sector rebased to that device.  Optional, a
+       device which has it gets no queue of its own. */
+    void (*submit) (void *aux, struct block_request *);
   };
 
 struct block *block_register (const char *name, enum block_type,
@@ -9,6 +9,7 @@
 #include "threads/io.h"
 #include "threads/interrupt.h"
 #include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
    controller.  It attempts to comply to [ATA-3]. */
@@ -34,6 +35,31 @@
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
+
+/* Bus master IDE port addresses. */
+#define reg_bm_command(CHANNEL) ((CHANNEL)->bm_base + 0) /* Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)  /* Status. */
+#define reg_bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)    /* PRD table. */
+
+/* Bus master Command Register bits. */
+#define BM_CMD_START 0x01       /* Start transfer. */
+#define BM_CMD_READ 0x08        /* Transfer from disk to memory. */
+
+/* Bus master Status Register bits. */
+#define BM_STA_ERR 0x02         /* Error, write 1 to clear. */
+#define BM_STA_INTR 0x04        /* Interrupt, write 1 to clear. */
+
+/* PCI configuration space access, used to find the bus master. */
+#define PCI_CONFIG_ADDRESS 0xcf8        /* Configuration address port. */
+#define PCI_CONFIG_DATA 0xcfc           /* Configuration data port. */
+#define PCI_REG_ID 0x00                 /* Device and vendor ID. */
+#define PCI_REG_COMMAND 0x04            /* Status and command. */
+#define PCI_REG_CLASS 0x08              /* Class code and revision. */
+#define PCI_REG_BAR4 0x20               /* Base address 4: bus master. */
+#define PCI_COMMAND_IO 0x0001           /* I/O space enable. */
+#define PCI_COMMAND_MASTER 0x0004       /* Bus master enable. */
+#define PCI_CLASS_IDE 0x0101            /* Mass storage, IDE. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -49,6 +75,14 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_MULTIPLE 0xc4          /* READ MULTIPLE. */
+#define CMD_WRITE_MULTIPLE 0xc5         /* WRITE MULTIPLE. */
+#define CMD_SET_MULTIPLE_MODE 0xc6      /* SET MULTIPLE MODE. */
+#define CMD_READ_DMA 0xc8               /* READ DMA. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA. */
+
+/* Maximum number of sectors transferred by a single command. */
+#define MAX_COMMAND_SECTORS 256
 
 /* An ATA device. */
 struct ata_disk
@@ -57,8 +91,27 @@ struct ata_disk
     struct channel *channel;    /* Channel that disk is attached to. */
     int dev_no;                 /* Device 0 or 1 for master or slave. */
     bool is_ata;                /* Is device an ATA disk? */
+    int multiple_cnt;           /* Sectors per interrupt of READ/WRITE
+                                   MULTIPLE, 0 if not supported. */
+    bool use_dma;               /* Transfer by bus master DMA? */
+  };
+
+/* Physical region descriptor: one physically contiguous part of
+   the memory of a DMA transfer. */
+struct prd
+  {
+    uint32_t addr;              /* Physical address. */
+    uint16_t size;              /* Size in bytes, 0 means 64 kB. */
+    uint16_t flags;             /* PRD_EOT in the last descriptor. */
   };
 
+#define PRD_EOT 0x8000          /* End of table. */
+#define PRD_BOUNDARY 0x10000    /* A region must not cross 64 kB. */
+
+/* Number of descriptors in a PRD table, enough for any buffer of
+   MAX_COMMAND_SECTORS sectors. */
+#define PRD_CNT 8
+
 /* An ATA channel (aka controller).
    Each channel can control up to two disks. */
 struct channel
@@ -72,6 +125,10 @@ struct channel
                                    any interrupt would be spurious. */
     struct semaphore completion_wait;   /* Up'd by interrupt handler. */
 
+    uint16_t bm_base;           /* Bus master base I/O port, 0 if none. */
+    struct prd prdt[PRD_CNT]    /* PRD table of the current DMA transfer, */
+      __attribute__ ((aligned (64))); /* must not cross 64 kB. */
+
     struct ata_disk devices[2];     /* The devices on this channel. */
   };
 
@@ -85,7 +142,8 @@ static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
 
-static void select_sector (struct ata_disk *, block_sector_t);
+static void set_multiple_mode (struct ata_disk *, int multiple_cnt);
+static void select_sector (struct ata_disk *, block_sector_t, size_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
@@ -97,11 +155,24 @@ static void select_device_wait (const struct ata_disk *);
 
 static void interrupt_handler (struct intr_frame *);
 
+static void ide_read_multiple (void *, block_sector_t, size_t, void *);
+static void ide_write_multiple (void *, block_sector_t, size_t,
+                                const void *);
+static void pio_read (struct ata_disk *, block_sector_t, size_t,
+                      uint8_t *);
+static void pio_write (struct ata_disk *, block_sector_t, size_t,
+                       const uint8_t *);
+static bool dma_transfer (struct ata_disk *, block_sector_t, size_t,
+                          void *, bool write);
+static bool prepare_prdt (struct channel *, const void *, size_t);
+static uint16_t find_bus_master (void);
+
 /* Initialize the disk subsystem and detect disks. */
 void
 ide_init (void) 
 {
   size_t chan_no;
+  uint16_t bm_base = find_bus_master ();
 
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
     {
@@ -123,6 +194,8 @@ ide_init (void)
         default:
           NOT_REACHED ();
         }
+      /* Each channel has 8 bus master registers. */
+      c->bm_base = bm_base != 0 ? bm_base + chan_no * 8 : 0;
       lock_init (&c->lock);
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
@@ -136,6 +209,8 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->multiple_cnt = 0;
+          d->use_dma = false;
         }
 
       /* Register interrupt handler. */
@@ -303,6 +378,15 @@ identify_ata_device (struct ata_disk *d)
       return;
     }
 
+  /* Use READ/WRITE MULTIPLE with the largest number of sectors
+     per interrupt the disk supports (low byte of word 47). */
+  if ((id[47 * 2] & 0xff) > 1)
+    set_multiple_mode (d, id[47 * 2] & 0xff);
+
+  /* Use DMA if the channel has a bus master and the disk supports
+     DMA (bit 8 of word 49). */
+  d->use_dma = c->bm_base != 0 && (id[49 * 2 + 1] & 0x01) != 0;
+
   /* Register. */
   block = block_register (d->name, BLOCK_RAW, extra_info, capacity,
                           &ide_operations, d);
@@ -344,16 +428,7 @@ descramble_ata_string (char *string, int size)
 static void
 ide_read (void *d_, block_sector_t sec_no, void *buffer)
 {
-  struct ata_disk *d = d_;
-  struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
-  lock_release (&c->lock);
+  ide_read_multiple (d_, sec_no, 1, buffer);
 }
 
 /* Write sector SEC_NO to disk D from BUFFER, which must contain
@@ -363,37 +438,309 @@ ide_read (void *d_, block_sector_t sec_no, void *buffer)
    per-disk locking is unneeded. */
 static void
 ide_write (void *d_, block_sector_t sec_no, const void *buffer)
+{
+  ide_write_multiple (d_, sec_no, 1, buffer);
+}
+
+/* Reads CNT sectors starting at SEC_NO from disk D into BUFFER,
+   which must have room for CNT * BLOCK_SECTOR_SIZE bytes.  Issues
+   one command per MAX_COMMAND_SECTORS sectors, which transfers
+   the data by bus master DMA if possible and by PIO otherwise.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_read_multiple (void *d_, block_sector_t sec_no, size_t cnt,
+                   void *buffer_)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+  uint8_t *buffer = buffer_;
+
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
+  while (cnt > 0)
+    {
+      size_t command_cnt = cnt < MAX_COMMAND_SECTORS
+                           ? cnt : MAX_COMMAND_SECTORS;
+
+      if (!dma_transfer (d, sec_no, command_cnt, buffer, false))
+        pio_read (d, sec_no, command_cnt, buffer);
+      buffer += command_cnt * BLOCK_SECTOR_SIZE;
+      sec_no += command_cnt;
+      cnt -= command_cnt;
+    }
   lock_release (&c->lock);
 }
 
+/* Writes CNT sectors starting at SEC_NO to disk D from BUFFER,
+   which must contain CNT * BLOCK_SECTOR_SIZE bytes, by bus master
+   DMA if possible and by PIO otherwise.  Returns after the disk
+   has acknowledged receiving the data.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_write_multiple (void *d_, block_sector_t sec_no, size_t cnt,
+                    const void *buffer_)
+{
+  struct ata_disk *d = d_;
+  struct channel *c = d->channel;
+  const uint8_t *buffer = buffer_;
+
+  lock_acquire (&c->lock);
+  while (cnt > 0)
+    {
+      size_t command_cnt = cnt < MAX_COMMAND_SECTORS
+                           ? cnt : MAX_COMMAND_SECTORS;
+
+      if (!dma_transfer (d, sec_no, command_cnt, (void *) buffer, true))
+        pio_write (d, sec_no, command_cnt, buffer);
+      buffer += command_cnt * BLOCK_SECTOR_SIZE;
+      sec_no += command_cnt;
+      cnt -= command_cnt;
+    }
+  lock_release (&c->lock);
+}
+
+/* Reads CNT sectors starting at SEC_NO from disk D into BUFFER in
+   PIO mode with a single command.  Uses READ MULTIPLE if the disk
+   supports it, so that the disk interrupts once per
+   D->multiple_cnt sectors instead of once per sector.  D's
+   channel must be locked. */
+static void
+pio_read (struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+          uint8_t *buffer)
+{
+  struct channel *c = d->channel;
+  bool multiple = d->multiple_cnt > 0 && cnt > 1;
+  size_t block_cnt = multiple ? (size_t) d->multiple_cnt : 1;
+  size_t done_cnt = 0;
+
+  select_sector (d, sec_no, cnt);
+  issue_pio_command (c, multiple ? CMD_READ_MULTIPLE : CMD_READ_SECTOR_RETRY);
+  while (done_cnt < cnt)
+    {
+      size_t i;
+
+      sema_down (&c->completion_wait);
+      if (!wait_while_busy (d))
+        PANIC ("%s: disk read failed, sector=%"PRDSNu,
+               d->name, sec_no + done_cnt);
+      for (i = 0; i < block_cnt && done_cnt < cnt; i++)
+        {
+          input_sector (c, buffer);
+          buffer += BLOCK_SECTOR_SIZE;
+          done_cnt++;
+        }
+    }
+}
+
+/* Writes CNT sectors starting at SEC_NO to disk D from BUFFER in
+   PIO mode with a single command, using WRITE MULTIPLE if the disk
+   supports it.  D's channel must be locked. */
+static void
+pio_write (struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+           const uint8_t *buffer)
+{
+  struct channel *c = d->channel;
+  bool multiple = d->multiple_cnt > 0 && cnt > 1;
+  size_t block_cnt = multiple ? (size_t) d->multiple_cnt : 1;
+  size_t done_cnt = 0;
+
+  select_sector (d, sec_no, cnt);
+  issue_pio_command (c, multiple
+                        ? CMD_WRITE_MULTIPLE : CMD_WRITE_SECTOR_RETRY);
+  while (done_cnt < cnt)
+    {
+      size_t i;
+
+      if (!wait_while_busy (d))
+        PANIC ("%s: disk write failed, sector=%"PRDSNu,
+               d->name, sec_no + done_cnt);
+      for (i = 0; i < block_cnt && done_cnt < cnt; i++)
+        {
+          output_sector (c, buffer);
+          buffer += BLOCK_SECTOR_SIZE;
+          done_cnt++;
+        }
+      sema_down (&c->completion_wait);
+    }
+}
+
+/* Bus master DMA. */
+
+/* Transfers CNT sectors starting at SEC_NO between disk D and
+   BUFFER by bus master DMA, from the disk if WRITE is false and to
+   the disk otherwise.  The CPU is free for other threads until the
+   completion interrupt arrives.  Returns false if nothing was
+   transferred because D or BUFFER can not be used for DMA, the
+   caller falls back to PIO then.  A failing transfer disables DMA
+   for D.  D's channel must be locked. */
+static bool
+dma_transfer (struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+              void *buffer, bool write)
+{
+  struct channel *c = d->channel;
+  uint8_t direction = write ? 0 : BM_CMD_READ;
+  uint8_t bm_status;
+
+  if (!d->use_dma || !prepare_prdt (c, buffer, cnt * BLOCK_SECTOR_SIZE))
+    return false;
+
+  /* Program the bus master, clear its error and interrupt bits by
+     writing them, and start the transfer after the command. */
+  outl (reg_bm_prdt (c), vtop (c->prdt));
+  outb (reg_bm_command (c), direction);
+  outb (reg_bm_status (c), inb (reg_bm_status (c)) | BM_STA_ERR | BM_STA_INTR);
+  select_sector (d, sec_no, cnt);
+  issue_pio_command (c, write ? CMD_WRITE_DMA : CMD_READ_DMA);
+  outb (reg_bm_command (c), direction | BM_CMD_START);
+
+  sema_down (&c->completion_wait);
+
+  outb (reg_bm_command (c), direction);
+  bm_status = inb (reg_bm_status (c));
+  outb (reg_bm_status (c), bm_status | BM_STA_ERR | BM_STA_INTR);
+  if ((bm_status & BM_STA_ERR) != 0
+      || (inb (reg_alt_status (c)) & STA_ERR) != 0)
+    {
+      printf ("%s: DMA %s failed at sector %"PRDSNu", using PIO\n",
+              d->name, write ? "write" : "read", sec_no);
+      d->use_dma = false;
+      return false;
+    }
+  return true;
+}
+
+/* Fills C's PRD table with the physical regions of the SIZE bytes
+   at BUFFER.  Returns false if BUFFER can not be used for DMA. */
+static bool
+prepare_prdt (struct channel *c, const void *buffer, size_t size)
+{
+  uintptr_t addr;
+  size_t prd_cnt = 0;
+
+  /* Kernel virtual memory maps physical memory contiguously. */
+  if (!is_kernel_vaddr (buffer))
+    return false;
+  addr = vtop (buffer);
+  if (addr % 2 != 0)
+    return false;
+
+  while (size > 0)
+    {
+      size_t region_size = PRD_BOUNDARY - addr % PRD_BOUNDARY;
+      if (region_size > size)
+        region_size = size;
+      if (prd_cnt == PRD_CNT)
+        return false;
+
+      c->prdt[prd_cnt].addr = addr;
+      c->prdt[prd_cnt].size = region_size % PRD_BOUNDARY;
+      c->prdt[prd_cnt].flags = 0;
+      prd_cnt++;
+
+      addr += region_size;
+      size -= region_size;
+    }
+  c->prdt[prd_cnt - 1].flags = PRD_EOT;
+  return true;
+}
+
+/* Reads the 32-bit register REG of the configuration space of PCI
+   device DEV, function FN on bus 0. */
+static uint32_t
+pci_read_config (int dev, int fn, uint8_t reg)
+{
+  outl (PCI_CONFIG_ADDRESS,
+        0x80000000 | (dev << 11) | (fn << 8) | (reg & 0xfc));
+  return inl (PCI_CONFIG_DATA);
+}
+
+/* Writes VALUE to the 32-bit register REG of the configuration
+   space of PCI device DEV, function FN on bus 0. */
+static void
+pci_write_config (int dev, int fn, uint8_t reg, uint32_t value)
+{
+  outl (PCI_CONFIG_ADDRESS,
+        0x80000000 | (dev << 11) | (fn << 8) | (reg & 0xfc));
+  outl (PCI_CONFIG_DATA, value);
+}
+
+/* Looks for an IDE controller on PCI bus 0, enables it as a bus
+   master, and returns the base port of its bus master registers.
+   Returns 0 if there is none, in which case only PIO is used. */
+static uint16_t
+find_bus_master (void)
+{
+  int dev, fn;
+
+  for (dev = 0; dev < 32; dev++)
+    for (fn = 0; fn < 8; fn++)
+      {
+        uint32_t bar4, command;
+
+        if ((pci_read_config (dev, fn, PCI_REG_ID) & 0xffff) == 0xffff)
+          {
+            if (fn == 0)
+              break;
+            continue;
+          }
+        if ((pci_read_config (dev, fn, PCI_REG_CLASS) >> 16)
+            != PCI_CLASS_IDE)
+          continue;
+        bar4 = pci_read_config (dev, fn, PCI_REG_BAR4);
+        if ((bar4 & 1) == 0 || (bar4 & 0xfffc) == 0)
+          continue;
+
+        /* Only write the command half, writing ones to the status
+           half would clear its bits. */
+        command = pci_read_config (dev, fn, PCI_REG_COMMAND) & 0xffff;
+        pci_write_config (dev, fn, PCI_REG_COMMAND,
+                          command | PCI_COMMAND_IO | PCI_COMMAND_MASTER);
+        return bar4 & 0xfffc;
+      }
+  return 0;
+}
+
 static struct block_operations ide_operations =
   {
     ide_read,
-    ide_write
+    ide_write,
+    ide_read_multiple,
+    ide_write_multiple,
+    NULL
   };
 
+/* Sends a SET MULTIPLE MODE command to disk D, so that READ/WRITE
+   MULTIPLE transfer MULTIPLE_CNT sectors per interrupt.  Leaves
+   D->multiple_cnt at 0 if the disk rejects the command. */
+static void
+set_multiple_mode (struct ata_disk *d, int multiple_cnt)
+{
+  struct channel *c = d->channel;
+
+  select_device_wait (d);
+  outb (reg_nsect (c), multiple_cnt);
+  issue_pio_command (c, CMD_SET_MULTIPLE_MODE);
+  sema_down (&c->completion_wait);
+  wait_while_busy (d);
+  if ((inb (reg_alt_status (c)) & STA_ERR) == 0)
+    d->multiple_cnt = multiple_cnt;
+}
+
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and the number CNT of sectors to transfer to the
+   disk's sector selection registers.  (We use LBA mode.) */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sector (struct ata_disk *d, block_sector_t sec_no, size_t cnt)
 {
   struct channel *c = d->channel;
 
   ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt > 0 && cnt <= MAX_COMMAND_SECTORS);
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  /* A count of 0 means MAX_COMMAND_SECTORS. */
+  outb (reg_nsect (c), cnt % MAX_COMMAND_SECTORS);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
@@ -24,38 +24,47 @@ list_dir (const char *dir, bool verbose)
 
   if (isdir (dir_fd))
     {
-      char name[READDIR_MAX_LEN];
+      char buffer[512];
+      int size;
 
       printf ("%s", dir);
       if (verbose)
         printf (" (inumber %d)", inumber (dir_fd));
       printf (":\n");
 
-      while (readdir (dir_fd, name)) 
+      /* Read as many entries per call as fit into BUFFER. */
+      while ((size = getdents (dir_fd, buffer, sizeof buffer)) > 0)
         {
-          printf ("%s", name); 
-          if (verbose) 
-            {
-              char full_name[128];
-              int entry_fd;
-
-              snprintf (full_name, sizeof full_name, "%s/%s", dir, name);
-              entry_fd = open (full_name);
+          const struct dirent *d;
+          int ofs;
 
-              printf (": ");
-              if (entry_fd != -1)
+          for (ofs = 0; ofs < size; ofs += d->reclen)
+            {
+              d = (const struct dirent *) (buffer + ofs);
+              printf ("%s", d->name);
+              if (verbose)
                 {
-                  if (isdir (entry_fd))
+                  printf (": ");
+                  if (d->is_dir)
                     printf ("directory");
                   else
-                    printf ("%d-byte file", filesize (entry_fd));
-                  printf (", inumber %d", inumber (entry_fd));
+                    {
+                      char full_name[strlen (dir) + 1 + NAME_MAX + 1];
+                      int entry_fd;
+
+                      snprintf (full_name, sizeof full_name, "%s/%s",
+                                dir, d->name);
+                      entry_fd = open (full_name);
+                      if (entry_fd != -1)
+                        printf ("%d-byte file", filesize (entry_fd));
+                      else
+                        printf ("open failed");
+                      close (entry_fd);
+                    }
+                  printf (", inumber %d", d->inumber);
                 }
-              else
-                printf ("open failed");
-              close (entry_fd);
+              printf ("\n");
             }
-          printf ("\n");
         }
     }
   else 
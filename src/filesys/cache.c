@@ -4,112 +4,376 @@
 #include "threads/thread.h"
 #include "threads/synch.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
 #include "filesys/filesys.h"
+#include <round.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 
-struct cache_block *filesys_cache_lookup(block_sector_t disk_sector);
+struct cache_block *filesys_cache_lookup(block_sector_t disk_sector,
+ bool demand);
 struct cache_block *filesys_cache_block_allocate(block_sector_t disk_sector,
  bool write_access);
-struct cache_block *filesys_cache_block_evict(void);
 void filesys_read_ahead_thread(void* aux UNUSED);
-void filesys_cache_queue_read_ahead(block_sector_t disk_sector);
 void filesys_cache_periodic_writeback(void* aux UNUSED);
-struct cache_block *filesys_cache_access(block_sector_t disk_sector,
- bool write_access, bool recoursive);
+void filesys_cache_writeback_timer(void* aux UNUSED);
+static struct cache_block *cache_block_reserve(block_sector_t disk_sector,
+ bool demand, bool *reserved);
+static void cache_block_read_done(struct cache_block *cache_block);
+static void read_ahead_sector(block_sector_t disk_sector);
+static void read_ahead_done(struct block_request *request, void *cache_block_);
+static unsigned cache_index_hash(const struct hash_elem *e, void *aux UNUSED);
+static bool cache_index_less(const struct hash_elem *a,
+ const struct hash_elem *b, void *aux UNUSED);
+static struct cache_block *cache_index_find(block_sector_t disk_sector);
+static void cache_block_wait_io(struct cache_block *cache_block);
+static bool cache_block_evictable(struct cache_block *cache_block);
+static void cache_block_mark_dirty(struct cache_block *cache_block);
+static void cache_block_mark_clean(struct cache_block *cache_block);
+static void cache_writeback_dirty_before(int64_t dirty_before);
+static int writeback_entry_compare(const void *a, const void *b);
+struct writeback_run;
+static void writeback_run_finish(struct writeback_run *run);
+static bool writeback_snapshot(struct cache_block *cache_block,
+ block_sector_t disk_sector, uint8_t *snapshot);
 
+static void clock_init(void);
+static void clock_insert(struct cache_block *cache_block, bool demand);
+static void clock_access(struct cache_block *cache_block);
+static void clock_remove(struct cache_block *cache_block);
+static struct cache_block *clock_select_victim(void);
+static void twoq_init(void);
+static void twoq_insert(struct cache_block *cache_block, bool demand);
+static void twoq_access(struct cache_block *cache_block);
+static void twoq_remove(struct cache_block *cache_block);
+static struct cache_block *twoq_select_victim(void);
+static struct cache_block *twoq_scan_queue(struct list *queue);
+static unsigned ghost_hash(const struct hash_elem *e, void *aux UNUSED);
+static bool ghost_less(const struct hash_elem *a, const struct hash_elem *b,
+ void *aux UNUSED);
 
-/* defines the maximal number of pages which can be inserted in read ahead
+
+/* interface of a replacement policy. All functions are called with
+   filesys_cache_lock held */
+struct cache_policy {
+  const char *name;
+  /* called once during filesys_cache_init */
+  void (*init)(void);
+  /* cache_block starts caching a (new) disk sector, on behalf of a file
+     system operation if demand is true and of read-ahead otherwise */
+  void (*insert)(struct cache_block *cache_block, bool demand);
+  /* cache_block was hit by a lookup on behalf of a file system operation */
+  void (*access)(struct cache_block *cache_block);
+  /* cache_block stops caching its disk sector */
+  void (*remove)(struct cache_block *cache_block);
+  /* returns an evictable block (see cache_block_evictable) to replace with
+     its cache_field_lock held, or NULL if every block is currently busy */
+  struct cache_block *(*select_victim)(void);
+};
+
+/* clock algorithm which keeps a block for one more lap per access */
+static const struct cache_policy clock_policy = {
+  "clock", clock_init, clock_insert, clock_access, clock_remove,
+  clock_select_victim
+};
+
+/* scan resistant 2Q policy [Johnson, Shasha: 2Q: A Low Overhead High
+   Performance Buffer Management Replacement Algorithm] */
+static const struct cache_policy twoq_policy = {
+  "2q", twoq_init, twoq_insert, twoq_access, twoq_remove, twoq_select_victim
+};
+
+/* policies which can be selected with -cache-policy=NAME */
+static const struct cache_policy *cache_policies[] = {
+  &twoq_policy, &clock_policy, NULL
+};
+
+/* policy in use */
+static const struct cache_policy *cache_policy;
+
+
+/* defines the maximal number of sectors which can be inserted in read ahead
 queue */
-#define MAX_READ_AHEAD_SIZE 32
+#define READ_AHEAD_QUEUE_SIZE 64
 
-/* lock to synchronise updates of read ahead queue size */
+/* lock to synchronise updates of read ahead queue */
 struct lock read_ahead_lock;
-/* list to store the next sectors to prefetch in cache */
-struct list read_ahead_queue;
+/* ring buffer storing the next sectors to prefetch in cache, the queue
+starts at read_ahead_queue_head */
+static block_sector_t read_ahead_queue[READ_AHEAD_QUEUE_SIZE];
+static int read_ahead_queue_head;
 /* semaphore to indicate if there are still elements in the
 read ahead queue; used to synchronise insert and pop */
 struct semaphore read_ahead_semaphore;
 /* stores the number of elements in the read ahead queue */
 int read_ahead_queue_size;
 
-/* defines a read ahead entry which entails the block sector
-which should be prefetched and list_elem to store them in the list */
-struct read_ahead_entry {
+/* number of cache entries */
+size_t filesys_cache_size = 0;
+
+/* name of the replacement policy in use */
+const char *filesys_cache_policy_name = "2q";
+
+/* contiguous page-aligned storage of the cached sectors, block i of
+   cache_array caches its sector in the i-th BLOCK_SECTOR_SIZE slice */
+static uint8_t *cache_arena;
+
+/* maximal number of adjacent sectors written back as one run */
+#define WRITEBACK_RUN_SECTORS 64
+/* number of runs of a write back pass submitted to the disk at once */
+#define WRITEBACK_RUNS 2
+
+/* dirty block collected by filesys_cache_writeback */
+struct writeback_entry {
   block_sector_t disk_sector;
-  struct list_elem elem;
+  struct cache_block *cache_block;
 };
 
+/* run of adjacent dirty blocks written back with one request */
+struct writeback_run {
+  struct block_request request;
+  bool pending;                 /* request submitted and not waited for */
+  size_t cnt;                   /* number of blocks in the run */
+  uint8_t *snapshots;           /* snapshots of the blocks, in order */
+  struct cache_block *blocks[WRITEBACK_RUN_SECTORS];  /* pinned blocks */
+};
+
+/* serializes write back passes, which share the following buffers */
+static struct lock writeback_lock;
+/* dirty blocks of the current pass, one entry per cache block at most */
+static struct writeback_entry *writeback_entries;
+/* runs of the current pass, used in turn so that the next run is collected
+   while the previous one is written */
+static struct writeback_run writeback_runs[WRITEBACK_RUNS];
+
+/* protects the dirty accounting below, acquired after cache_field_lock */
+static struct lock dirty_lock;
+/* number of dirty cache blocks */
+static size_t dirty_cnt;
+/* dirty_cnt at which the flusher is woken up early */
+static size_t dirty_high_water;
+/* signaled when the first block becomes dirty */
+static struct condition dirty_cond;
+/* signaled when flush_requested is set */
+static struct condition flush_cond;
+/* set to let the flusher write back blocks */
+static bool flush_requested;
+
+/* index of all cached blocks keyed by disk_sector, protected by
+filesys_cache_lock. Used instead of scanning the whole cache_array on every
+lookup */
+static struct hash cache_index;
+
 /* initializes cache structure */
 void
 filesys_cache_init(){
-  int i = 0;
-  for (i = 0; i < CACHE_SIZE; i++) {
-    cache_array[i] = NULL;
+  /* check the size before allocating anything, so that a size too large for
+     the kernel pool fails with a clear message instead of an allocation
+     failure or an overflowing arena size */
+  size_t free_pages = palloc_free_cnt(0);
+  size_t sectors_per_page = PGSIZE / BLOCK_SECTOR_SIZE;
+  size_t max_sectors = free_pages * CACHE_MAX_PAGES_PERCENT / 100
+                       * sectors_per_page;
+  if (filesys_cache_size == 0) {
+    size_t default_sectors = free_pages * CACHE_DEFAULT_PAGES_PERCENT / 100
+                             * sectors_per_page;
+    filesys_cache_size = CACHE_DEFAULT_SIZE < default_sectors
+                         ? CACHE_DEFAULT_SIZE : default_sectors;
+  } else if (filesys_cache_size > max_sectors)
+    PANIC("cache size of %zu sectors is too large, at most %zu sectors fit "
+          "into %d%% of the %zu free kernel pages", filesys_cache_size,
+          max_sectors, CACHE_MAX_PAGES_PERCENT, free_pages);
+  if (filesys_cache_size < CACHE_MIN_SIZE)
+    PANIC("cache size of %zu sectors is too small", filesys_cache_size);
+
+  /* allocate all cache entries up front: metadata and data separately */
+  size_t arena_pages = DIV_ROUND_UP(filesys_cache_size * BLOCK_SECTOR_SIZE,
+                                    PGSIZE);
+  cache_arena = palloc_get_multiple(0, arena_pages);
+  cache_array = malloc(filesys_cache_size * sizeof *cache_array);
+  if (cache_arena == NULL || cache_array == NULL)
+    PANIC("can't allocate buffer cache of %zu sectors", filesys_cache_size);
+
+  size_t i = 0;
+  for (i = 0; i < filesys_cache_size; i++) {
+    cache_array[i].cached_content = cache_arena + i * BLOCK_SECTOR_SIZE;
+    lock_init(&cache_array[i].cache_field_lock);
+    cond_init(&cache_array[i].io_done);
+    rw_lock_init(&cache_array[i].content_lock);
+    cache_array[i].io_in_progress = false;
+    cache_array[i].dirty = false;
   }
 
+  if (!hash_init(&cache_index, cache_index_hash, cache_index_less, NULL))
+    PANIC("cache index creation failed");
+
+  writeback_entries = malloc(filesys_cache_size * sizeof *writeback_entries);
+  if (writeback_entries == NULL)
+    PANIC("can't allocate buffer cache write back buffers");
+  for (i = 0; i < WRITEBACK_RUNS; i++) {
+    writeback_runs[i].pending = false;
+    writeback_runs[i].cnt = 0;
+    writeback_runs[i].snapshots = palloc_get_multiple(0,
+      DIV_ROUND_UP(WRITEBACK_RUN_SECTORS * BLOCK_SECTOR_SIZE, PGSIZE));
+    if (writeback_runs[i].snapshots == NULL)
+      PANIC("can't allocate buffer cache write back buffers");
+  }
+  lock_init(&writeback_lock);
+
+  lock_init(&dirty_lock);
+  cond_init(&dirty_cond);
+  cond_init(&flush_cond);
+  dirty_cnt = 0;
+  dirty_high_water = filesys_cache_size * DIRTY_HIGH_WATER_PERCENT / 100;
+  flush_requested = false;
+
+  const struct cache_policy **policy_iter = cache_policies;
+  for (policy_iter = cache_policies; *policy_iter != NULL; policy_iter++)
+    if (!strcmp((*policy_iter)->name, filesys_cache_policy_name))
+      break;
+  if (*policy_iter == NULL)
+    PANIC("unknown cache policy `%s'", filesys_cache_policy_name);
+  cache_policy = *policy_iter;
+  cache_policy->init();
+
   lock_init(&filesys_cache_lock);
-  lock_init(&filesys_cache_evict_lock);
   lock_init(&read_ahead_lock);
-  list_init(&read_ahead_queue);
   sema_init(&read_ahead_semaphore, 0);
+  read_ahead_queue_head = 0;
   read_ahead_queue_size = 0;
 
   next_free_cache = 0;
-  next_evict_cache = 0;
 
-  /* start writeback thread */
+  /* start writeback threads */
   thread_create("periodic_writeback", 0, filesys_cache_periodic_writeback , NULL);
+  thread_create("writeback_timer", 0, filesys_cache_writeback_timer, NULL);
   /* start read-ahead thread */
   thread_create("read_ahead", 0, filesys_read_ahead_thread, NULL);
 }
 
 
+/* hash function of the cache index, cache blocks are hashed by their
+   disk_sector */
+static unsigned
+cache_index_hash(const struct hash_elem *e, void *aux UNUSED) {
+  const struct cache_block *cache_block =
+    hash_entry(e, struct cache_block, hash_elem);
+  return hash_int(cache_block->disk_sector);
+}
+
+
+/* comparison function of the cache index */
+static bool
+cache_index_less(const struct hash_elem *a, const struct hash_elem *b,
+ void *aux UNUSED) {
+  const struct cache_block *block_a =
+    hash_entry(a, struct cache_block, hash_elem);
+  const struct cache_block *block_b =
+    hash_entry(b, struct cache_block, hash_elem);
+  return block_a->disk_sector < block_b->disk_sector;
+}
+
+
+/* returns the indexed cache block of disk_sector or NULL, the caller has
+   to hold filesys_cache_lock. No cache_field_lock is acquired. */
+static struct cache_block*
+cache_index_find(block_sector_t disk_sector) {
+  ASSERT(lock_held_by_current_thread(&filesys_cache_lock));
+
+  struct cache_block key;
+  key.disk_sector = disk_sector;
+  struct hash_elem *e = hash_find(&cache_index, &key.hash_elem);
+  if (e == NULL)
+    return NULL;
+  return hash_entry(e, struct cache_block, hash_elem);
+}
+
+
+/* waits until the disk I/O on cache_block has finished, the caller has to
+   hold its cache_field_lock (which is released while waiting) */
+static void
+cache_block_wait_io(struct cache_block *cache_block) {
+  ASSERT(lock_held_by_current_thread(&cache_block->cache_field_lock));
+  while (cache_block->io_in_progress)
+    cond_wait(&cache_block->io_done, &cache_block->cache_field_lock);
+}
+
+
+/* returns true if cache_block may be replaced right now, the caller has to
+   hold its cache_field_lock */
+static bool
+cache_block_evictable(struct cache_block *cache_block) {
+  ASSERT(lock_held_by_current_thread(&cache_block->cache_field_lock));
+  return !cache_block->io_in_progress && cache_block->pin_cnt == 0;
+}
+
+
 /* returns reference to cache_block of disk_sector or NULL if this
    disk_sector is currently not cached. The cache_field_lock of the retunred 
-   cache block is HELD! */
+   cache block is HELD! 
+   The index is probed under filesys_cache_lock, but the cache_field_lock is
+   acquired only after dropping it. If the block is currently read in or
+   written back, waits for this I/O to finish. The block might have been
+   evicted in between, in which case the lookup is repeated.
+   Only demand lookups count as an access for the replacement policy,
+   read-ahead does not. */
 struct cache_block*
-filesys_cache_lookup(block_sector_t disk_sector) {
-  int i = 0;
-  for (i = 0; i < CACHE_SIZE; i++) {
-    if (cache_array[i] != NULL) {
-      lock_acquire(&cache_array[i]->cache_field_lock);
-      if (cache_array[i]->disk_sector == disk_sector){
-        /* lock is held after return !! */
-        return cache_array[i];
-      }
-      lock_release(&cache_array[i]->cache_field_lock);
+filesys_cache_lookup(block_sector_t disk_sector, bool demand) {
+  while (true) {
+    lock_acquire(&filesys_cache_lock);
+    struct cache_block *cache_block = cache_index_find(disk_sector);
+    if (cache_block != NULL && demand)
+      cache_policy->access(cache_block);
+    lock_release(&filesys_cache_lock);
+
+    if (cache_block == NULL)
+      return NULL;
+
+    lock_acquire(&cache_block->cache_field_lock);
+    cache_block_wait_io(cache_block);
+    if (cache_block->disk_sector == disk_sector){
+      /* lock is held after return !! */
+      return cache_block;
     }
+    lock_release(&cache_block->cache_field_lock);
   }
-
-  return NULL;
 }
 
 
-/* access the disk sector at disk_sector, which causes this disk_sector to be
-   loaded into the cache structure (if not loaded already) also updates METADATA
-   necessary for eviciton.
-   If recursive is true no read-ahead is called */
+/* returns the cache block of disk_sector, which is read from disk if not
+   cached yet. The returned block is pinned: it stays in the cache and keeps
+   caching disk_sector until filesys_cache_unpin is called. No lock is held
+   on return, the content has to be accessed under its content_lock. */
 struct cache_block*
-filesys_cache_access(block_sector_t disk_sector, bool write_access, bool recursive){
-  struct cache_block *lookup_cache_block = filesys_cache_lookup(disk_sector);
-  if (lookup_cache_block == NULL){
-    lookup_cache_block = filesys_cache_block_allocate(disk_sector, write_access);
-    lock_release(&lookup_cache_block->cache_field_lock);
-  } else {
-    /* lookup has to hold the returned block cache lock */
-    ASSERT(lock_held_by_current_thread(&lookup_cache_block->cache_field_lock));
-    lookup_cache_block->accessed = true;
-    lookup_cache_block->accessed_counter += 1;
-    lookup_cache_block->dirty |= write_access;
-    lock_release(&lookup_cache_block->cache_field_lock);
-  }
+filesys_cache_pin(block_sector_t disk_sector) {
+  struct cache_block *cache_block = filesys_cache_lookup(disk_sector, true);
 
-  if (!recursive){
-    filesys_cache_queue_read_ahead(disk_sector + 1);
-  }
-  return lookup_cache_block;
+  if (cache_block == NULL)
+    cache_block = filesys_cache_block_allocate(disk_sector, false);
+
+  /* lookup has to hold the returned block cache lock */
+  ASSERT(lock_held_by_current_thread(&cache_block->cache_field_lock));
+  ASSERT(cache_block->disk_sector == disk_sector);
+  cache_block->accessed = true;
+  cache_block->pin_cnt += 1;
+  lock_release(&cache_block->cache_field_lock);
+  return cache_block;
+}
+
+
+/* releases a pin of cache_block taken by filesys_cache_pin. dirty has to be
+   true if the content was modified, the block is then written back later */
+void
+filesys_cache_unpin(struct cache_block *cache_block, bool dirty) {
+  lock_acquire(&cache_block->cache_field_lock);
+  ASSERT(cache_block->pin_cnt > 0);
+  cache_block->pin_cnt -= 1;
+  if (dirty)
+    cache_block_mark_dirty(cache_block);
+  lock_release(&cache_block->cache_field_lock);
 }
 
 
@@ -118,221 +382,765 @@ void
 filesys_cache_read(block_sector_t disk_sector, void *buffer,
  off_t sector_offset, int chunk_size) {
   ASSERT(buffer != NULL);
-  struct cache_block *lookup_cache_block = filesys_cache_lookup(disk_sector);
+  struct cache_block *cache_block = filesys_cache_pin(disk_sector);
 
-  if (lookup_cache_block == NULL) {
-    lookup_cache_block = filesys_cache_block_allocate(disk_sector, false);
-  } else {
-    lookup_cache_block->accessed_counter += 1;
+  /* readers of the same block copy out concurrently */
+  rw_lock_acquire_shared(&cache_block->content_lock);
+  memcpy(buffer, cache_block->cached_content + sector_offset, chunk_size);
+  rw_lock_release_shared(&cache_block->content_lock);
+
+  filesys_cache_unpin(cache_block, false);
+}
+
+
+/* write chunk_size amount of bytes from buffer to disk starting at
+sector_offset */
+void
+filesys_cache_write(block_sector_t disk_sector, void *buffer,
+ off_t sector_offset, int chunk_size) {
+  ASSERT(buffer != NULL);
+  struct cache_block *cache_block = filesys_cache_pin(disk_sector);
+
+  rw_lock_acquire_exclusive(&cache_block->content_lock);
+  memcpy(cache_block->cached_content + sector_offset, buffer, chunk_size);
+  rw_lock_release_exclusive(&cache_block->content_lock);
+
+  /* the block is marked dirty only after the copy has finished, so that a
+     concurrent write back can not clear the dirty bit of a partial write */
+  filesys_cache_unpin(cache_block, true);
+}
+
+
+/* caches disk_sector as a sector of zeros and marks it dirty, for sectors
+   which were just allocated. Their old content is not read from disk */
+void
+filesys_cache_zero(block_sector_t disk_sector) {
+  struct cache_block *cache_block = filesys_cache_lookup(disk_sector, true);
+
+  if (cache_block == NULL) {
+    bool reserved;
+    cache_block = cache_block_reserve(disk_sector, true, &reserved);
+    if (reserved) {
+      memset(cache_block->cached_content, 0, BLOCK_SECTOR_SIZE);
+      cache_block_read_done(cache_block);
+    }
   }
 
-  /* lookup has to hold the returned block cache lock */
-  ASSERT(lock_held_by_current_thread(&lookup_cache_block->cache_field_lock));
-  lookup_cache_block->accessed = true;
-  lookup_cache_block->read_writer_working += 1;
-  lock_release(&lookup_cache_block->cache_field_lock);
-  memcpy(buffer, (uint8_t *) &lookup_cache_block->cached_content +
-   sector_offset, chunk_size);
+  /* a block cached already still holds old content, pin it like
+     filesys_cache_pin and clear it */
+  ASSERT(lock_held_by_current_thread(&cache_block->cache_field_lock));
+  ASSERT(cache_block->disk_sector == disk_sector);
+  cache_block->accessed = true;
+  cache_block->pin_cnt += 1;
+  lock_release(&cache_block->cache_field_lock);
+
+  rw_lock_acquire_exclusive(&cache_block->content_lock);
+  memset(cache_block->cached_content, 0, BLOCK_SECTOR_SIZE);
+  rw_lock_release_exclusive(&cache_block->content_lock);
+
+  filesys_cache_unpin(cache_block, true);
+}
 
 
-  lock_acquire(&lookup_cache_block->cache_field_lock);
-  lookup_cache_block->read_writer_working -= 1;
-  lock_release(&lookup_cache_block->cache_field_lock);
+/* returns a pointer to the cached content of disk_sector, so that callers
+   which need only a few bytes of a sector or modify it in place do not have
+   to copy the whole sector. The block stays pinned and its content locked
+   (exclusively if exclusive is true, shared otherwise) until the pointer is
+   released with filesys_cache_put */
+void*
+filesys_cache_get(block_sector_t disk_sector, bool exclusive) {
+  struct cache_block *cache_block = filesys_cache_pin(disk_sector);
 
-  // read ahead
-  filesys_cache_queue_read_ahead(disk_sector + 1);
+  if (exclusive)
+    rw_lock_acquire_exclusive(&cache_block->content_lock);
+  else
+    rw_lock_acquire_shared(&cache_block->content_lock);
+  return cache_block->cached_content;
 }
 
 
-/* read from disk starting at sector_offset chunk_size amount of 
-bytes into buffer */
+/* releases content returned by filesys_cache_get, dirty has to be true if
+   the content was modified */
 void
-filesys_cache_write(block_sector_t disk_sector, void *buffer,
- off_t sector_offset, int chunk_size) {
-  
-  ASSERT(buffer != NULL);
-  struct cache_block *lookup_cache_block = filesys_cache_lookup(disk_sector);
+filesys_cache_put(const void *content, bool dirty) {
+  ASSERT((const uint8_t *) content >= cache_arena);
+  size_t index = ((const uint8_t *) content - cache_arena) / BLOCK_SECTOR_SIZE;
+  ASSERT(index < filesys_cache_size);
+  struct cache_block *cache_block = &cache_array[index];
+  ASSERT(cache_block->cached_content == content);
 
-  if (lookup_cache_block == NULL) {
-    lookup_cache_block = filesys_cache_block_allocate(disk_sector, false);
+  if (rw_lock_held_exclusive_by_current_thread(&cache_block->content_lock)) {
+    rw_lock_release_exclusive(&cache_block->content_lock);
   } else {
-    lookup_cache_block->accessed_counter += 1;
+    ASSERT(!dirty);
+    rw_lock_release_shared(&cache_block->content_lock);
   }
-  
-
-  /* lookup has to hold the returned block cache lock */
-  ASSERT(lock_held_by_current_thread(&lookup_cache_block->cache_field_lock));
-  ASSERT(lookup_cache_block->disk_sector == disk_sector);
-  lookup_cache_block->accessed = true;
-  lookup_cache_block->dirty = true;
-  /* increment reader_writer_working similar to pinning ensures that page
-    will not be evicted during write operation */
-  lookup_cache_block->read_writer_working += 1;
-  lock_release(&lookup_cache_block->cache_field_lock);
-  /* write */
-  memcpy((uint8_t *) &lookup_cache_block->cached_content + sector_offset,
-   buffer, chunk_size);
-  lock_acquire(&lookup_cache_block->cache_field_lock);
-  /* write is finished block could be evicted if no other read/write operation
-   needs the block -> decrement read_writer_working */
-  lookup_cache_block->read_writer_working -= 1;
-  lock_release(&lookup_cache_block->cache_field_lock);
-
-  // read ahead
-  filesys_cache_queue_read_ahead(disk_sector + 1);
+  filesys_cache_unpin(cache_block, dirty);
 }
 
 
 /* allocate new cache for disk_sector, which might call eviction to instead 
-replace a currently cached sector holds cache_block lock afterwards*/
+   replace a currently cached sector holds cache_block lock afterwards.
+   Misses on different sectors proceed in parallel, see cache_block_reserve */
 struct cache_block*
 filesys_cache_block_allocate(block_sector_t disk_sector, bool write_access) {
+  bool reserved;
+  struct cache_block *cache_block =
+    cache_block_reserve(disk_sector, true, &reserved);
 
-  lock_acquire(&filesys_cache_lock);
-  if (next_free_cache < CACHE_SIZE) {
-    /* case for new cache entry allocation */
-    struct cache_block *new_cache_block =
-      (struct cache_block*) malloc(sizeof(struct cache_block));
-    new_cache_block->accessed = true;
-    new_cache_block->dirty = write_access;
-    new_cache_block->disk_sector = disk_sector;
-    new_cache_block->accessed_counter = 0;
-    new_cache_block->read_writer_working = 0;
-    lock_init(&new_cache_block->cache_field_lock);
+  if (reserved) {
     /* write content of disk_sector to cached_content array */
-    block_read(fs_device, disk_sector, new_cache_block->cached_content);
+    block_read(fs_device, disk_sector, cache_block->cached_content);
+    cache_block_read_done(cache_block);
+  }
 
-    cache_array[next_free_cache] = new_cache_block;
-    next_free_cache += 1;
-    lock_release(&filesys_cache_lock);
-    lock_acquire(&new_cache_block->cache_field_lock);
-    return new_cache_block;
+  cache_block->accessed = true;
+  if (write_access)
+    cache_block_mark_dirty(cache_block);
+  return cache_block;
+}
 
-  } else {
-    /* case for eviction */
-    lock_acquire(&filesys_cache_evict_lock);
-    struct cache_block *replace_cache_block = filesys_cache_block_evict();
-    ASSERT(lock_held_by_current_thread(
-      &replace_cache_block->cache_field_lock));
 
+/* returns the block caching disk_sector with its cache_field_lock held and
+   sets *reserved to false if disk_sector is cached already. Otherwise a
+   block, possibly evicted, is reserved for disk_sector under
+   filesys_cache_lock and marked io_in_progress, *reserved is set to true and
+   the block is returned without any lock held. The caller has to read the
+   content from disk and call cache_block_read_done. Other threads looking
+   for the same sector wait on the block meanwhile. A dirty victim is
+   written back the same way while still indexed under its old sector, then
+   the policy is asked again. Only demand hits count as an access for the
+   replacement policy */
+static struct cache_block*
+cache_block_reserve(block_sector_t disk_sector, bool demand, bool *reserved) {
+  lock_acquire(&filesys_cache_lock);
+  while (true) {
+    /* another thread might have cached disk_sector since our lookup failed,
+       never cache the same sector twice */
+    struct cache_block *cached_block = cache_index_find(disk_sector);
+    if (cached_block != NULL) {
+      if (demand)
+        cache_policy->access(cached_block);
+      lock_acquire(&cached_block->cache_field_lock);
+      lock_release(&filesys_cache_lock);
+      cache_block_wait_io(cached_block);
+      if (cached_block->disk_sector == disk_sector) {
+        *reserved = false;
+        return cached_block;
+      }
+      /* evicted again while we waited */
+      lock_release(&cached_block->cache_field_lock);
+      lock_acquire(&filesys_cache_lock);
+      continue;
+    }
+
+    struct cache_block *replace_cache_block = NULL;
+    if ((size_t) next_free_cache < filesys_cache_size) {
+      /* case for first use of a preallocated cache entry */
+      replace_cache_block = &cache_array[next_free_cache];
+      next_free_cache += 1;
+      lock_acquire(&replace_cache_block->cache_field_lock);
+    } else {
+      /* case for eviction */
+      replace_cache_block = cache_policy->select_victim();
+      if (replace_cache_block == NULL) {
+        /* every block is pinned or under I/O, let their users finish */
+        lock_release(&filesys_cache_lock);
+        thread_yield();
+        lock_acquire(&filesys_cache_lock);
+        continue;
+      }
+      ASSERT(lock_held_by_current_thread(
+        &replace_cache_block->cache_field_lock));
+
+      if (replace_cache_block->dirty) {
+        /* write back without global lock, lookups of the old sector wait
+           until the write has finished */
+        replace_cache_block->io_in_progress = true;
+        lock_release(&replace_cache_block->cache_field_lock);
+        lock_release(&filesys_cache_lock);
+
+        block_write(fs_device, replace_cache_block->disk_sector,
+         replace_cache_block->cached_content);
+
+        lock_acquire(&replace_cache_block->cache_field_lock);
+        cache_block_mark_clean(replace_cache_block);
+        replace_cache_block->io_in_progress = false;
+        cond_broadcast(&replace_cache_block->io_done,
+         &replace_cache_block->cache_field_lock);
+        lock_release(&replace_cache_block->cache_field_lock);
+
+        lock_acquire(&filesys_cache_lock);
+        continue;
+      }
+      cache_policy->remove(replace_cache_block);
+      hash_delete(&cache_index, &replace_cache_block->hash_elem);
+    }
+
+    /* reserve the block for disk_sector */
     replace_cache_block->accessed = true;
-    replace_cache_block->dirty = write_access;
     replace_cache_block->disk_sector = disk_sector;
-    replace_cache_block->accessed_counter = 0;
-    replace_cache_block->read_writer_working = 0;
-    /* write content of disk_sector to cached_content array */
-    block_read(fs_device, disk_sector, replace_cache_block->cached_content);
-    lock_release(&filesys_cache_evict_lock);
+    replace_cache_block->pin_cnt = 0;
+    replace_cache_block->io_in_progress = true;
+    hash_insert(&cache_index, &replace_cache_block->hash_elem);
+    cache_policy->insert(replace_cache_block, demand);
+    lock_release(&replace_cache_block->cache_field_lock);
     lock_release(&filesys_cache_lock);
+
+    *reserved = true;
     return replace_cache_block;
   }
 }
 
 
-/* simple clock algorithm to evict cache */
-struct cache_block*
-filesys_cache_block_evict() {
-  ASSERT(lock_held_by_current_thread(&filesys_cache_evict_lock));
+/* marks the content of cache_block reserved by cache_block_reserve as read
+   in and wakes up the threads waiting for it. Holds the cache_field_lock of
+   cache_block afterwards */
+static void
+cache_block_read_done(struct cache_block *cache_block) {
+  lock_acquire(&cache_block->cache_field_lock);
+  ASSERT(cache_block->io_in_progress);
+  cache_block->io_in_progress = false;
+  cond_broadcast(&cache_block->io_done, &cache_block->cache_field_lock);
+}
+
+
+/* initializes the clock policy */
+static void
+clock_init(void) {
+  next_evict_cache = 0;
+}
+
+
+/* a newly cached block starts without any lap to survive */
+static void
+clock_insert(struct cache_block *cache_block, bool demand UNUSED) {
+  cache_block->accessed_counter = 0;
+}
+
+
+/* every access lets the block survive one more lap of the clock */
+static void
+clock_access(struct cache_block *cache_block) {
+  cache_block->accessed_counter += 1;
+}
+
+
+/* the clock keeps no per block state besides the counter */
+static void
+clock_remove(struct cache_block *cache_block UNUSED) {
+}
+
+
+/* simple clock algorithm to select the cache block to evict. Blocks in use
+   or under I/O are skipped. Holds the cache_field_lock of the returned
+   block */
+static struct cache_block*
+clock_select_victim(void) {
   ASSERT(lock_held_by_current_thread(&filesys_cache_lock));
 
   while(true) {
-    struct cache_block *iter_cache_block = cache_array[next_evict_cache];
+    struct cache_block *iter_cache_block = &cache_array[next_evict_cache];
     lock_acquire(&iter_cache_block->cache_field_lock);
+    next_evict_cache = (next_evict_cache + 1) % filesys_cache_size;
+    if (!cache_block_evictable(iter_cache_block)) {
+      /* dont evict entry if readers / writers are currently working on it */
+      lock_release(&iter_cache_block->cache_field_lock);
+      continue;
+    }
     if (iter_cache_block->accessed_counter > 0) {
       iter_cache_block->accessed = false;
       iter_cache_block->accessed_counter -= 1;
       lock_release(&iter_cache_block->cache_field_lock);
-      next_evict_cache = (next_evict_cache + 1) % CACHE_SIZE;
+      continue;
+    }
+    /* holds iter_cache_block lock on return */
+    return iter_cache_block;
+  }
+}
+
+
+/* 2Q keeps blocks referenced only once in the FIFO a1in_queue and moves them
+   to the LRU am_queue when they are referenced again later on. Sectors
+   recently evicted from a1in_queue are remembered in the ghost queue a1out;
+   if such a sector is read again it directly enters am_queue. A sequential
+   scan therefore only ever replaces blocks of a1in_queue, blocks in
+   am_queue (directory and inode sectors, indirect blocks, ...) survive. */
+
+/* queues a cache block can be on */
+#define TWOQ_NONE 0
+#define TWOQ_A1IN 1
+#define TWOQ_AM 2
+
+/* a1in_queue and a1out are sized relative to the cache as suggested in the
+   2Q paper: 25% of the cache for a1in, ghosts for 50% of the cache */
+#define TWOQ_A1IN_PERCENT 25
+#define TWOQ_A1OUT_PERCENT 50
+
+/* FIFO of blocks referenced once, front is the oldest */
+static struct list a1in_queue;
+/* LRU of blocks referenced again, front is the least recently used */
+static struct list am_queue;
+/* number of blocks in a1in_queue and the size it is trimmed to */
+static size_t a1in_cnt;
+static size_t a1in_max;
+
+/* number of insertions into a1in_queue so far */
+static unsigned a1in_clock;
+/* a hit on a block of a1in_queue which was queued less than this many
+   insertions ago is correlated to the first reference (e.g. the next chunk
+   of a sequential read of the same sector) and does not promote the block */
+static unsigned a1in_correlated;
+
+/* remembers the sector of a block evicted from a1in_queue */
+struct cache_ghost {
+  block_sector_t disk_sector;
+  struct list_elem elem;        /* element in a1out_queue or ghost_free */
+  struct hash_elem hash_elem;   /* element in a1out_index */
+};
+
+/* FIFO of ghosts, front is the oldest, and its index keyed by sector */
+static struct list a1out_queue;
+static struct hash a1out_index;
+/* unused ghosts */
+static struct list ghost_free;
+
+
+/* initializes the 2Q policy */
+static void
+twoq_init(void) {
+  list_init(&a1in_queue);
+  list_init(&am_queue);
+  list_init(&a1out_queue);
+  list_init(&ghost_free);
+  a1in_cnt = 0;
+  a1in_max = filesys_cache_size * TWOQ_A1IN_PERCENT / 100;
+  a1in_clock = 0;
+  a1in_correlated = a1in_max / 2;
+
+  size_t ghost_cnt = filesys_cache_size * TWOQ_A1OUT_PERCENT / 100;
+  struct cache_ghost *ghosts = malloc(ghost_cnt * sizeof *ghosts);
+  if (ghosts == NULL
+      || !hash_init(&a1out_index, ghost_hash, ghost_less, NULL))
+    PANIC("can't allocate 2Q ghost queue");
+  size_t i = 0;
+  for (i = 0; i < ghost_cnt; i++)
+    list_push_back(&ghost_free, &ghosts[i].elem);
+}
+
+
+/* a block enters am_queue if its sector is remembered as a ghost, otherwise
+   it enters a1in_queue. A block read ahead is not referenced yet, the first
+   demand hit on it counts as its first reference */
+static void
+twoq_insert(struct cache_block *cache_block, bool demand) {
+  cache_block->prefetched = !demand;
+
+  struct cache_ghost key;
+  key.disk_sector = cache_block->disk_sector;
+  struct hash_elem *e = hash_delete(&a1out_index, &key.hash_elem);
+  if (e != NULL) {
+    struct cache_ghost *ghost = hash_entry(e, struct cache_ghost, hash_elem);
+    list_remove(&ghost->elem);
+    list_push_back(&ghost_free, &ghost->elem);
+
+    cache_block->policy_queue = TWOQ_AM;
+    list_push_back(&am_queue, &cache_block->policy_elem);
+  } else {
+    cache_block->policy_queue = TWOQ_A1IN;
+    cache_block->policy_stamp = a1in_clock++;
+    list_push_back(&a1in_queue, &cache_block->policy_elem);
+    a1in_cnt += 1;
+  }
+}
+
+
+/* hits in am_queue make the block most recently used, uncorrelated hits in
+   a1in_queue promote the block to am_queue */
+static void
+twoq_access(struct cache_block *cache_block) {
+  if (cache_block->prefetched) {
+    /* otherwise every block read ahead of a sequential reader would be
+       promoted by the reader catching up with it */
+    cache_block->prefetched = false;
+    if (cache_block->policy_queue == TWOQ_A1IN) {
+      cache_block->policy_stamp = a1in_clock;
+      return;
+    }
+  }
+  if (cache_block->policy_queue == TWOQ_A1IN) {
+    if (a1in_clock - cache_block->policy_stamp <= a1in_correlated)
+      return;
+    a1in_cnt -= 1;
+  }
+  list_remove(&cache_block->policy_elem);
+  cache_block->policy_queue = TWOQ_AM;
+  list_push_back(&am_queue, &cache_block->policy_elem);
+}
+
+
+/* blocks evicted from a1in_queue are remembered as ghosts */
+static void
+twoq_remove(struct cache_block *cache_block) {
+  list_remove(&cache_block->policy_elem);
+  if (cache_block->policy_queue == TWOQ_A1IN) {
+    a1in_cnt -= 1;
+
+    struct cache_ghost *ghost;
+    if (!list_empty(&ghost_free)) {
+      ghost = list_entry(list_pop_front(&ghost_free), struct cache_ghost,
+                         elem);
+    } else if (!list_empty(&a1out_queue)) {
+      /* forget the oldest ghost */
+      ghost = list_entry(list_pop_front(&a1out_queue), struct cache_ghost,
+                         elem);
+      hash_delete(&a1out_index, &ghost->hash_elem);
     } else {
-      if (iter_cache_block->read_writer_working > 0){
-        /* dont evict entry if no readers / writers are currently working on it */
-        lock_release(&iter_cache_block->cache_field_lock);
-        next_evict_cache = (next_evict_cache + 1) % CACHE_SIZE;
-        continue;
-      }
-      if (iter_cache_block->dirty)
-        block_write(fs_device, iter_cache_block->disk_sector,
-         &iter_cache_block->cached_content);
-      next_evict_cache = (next_evict_cache + 1) % CACHE_SIZE;
-      /* holds iter_cache_block lock on return */
-      return iter_cache_block;
+      ghost = NULL;
     }
+
+    if (ghost != NULL) {
+      ghost->disk_sector = cache_block->disk_sector;
+      if (hash_insert(&a1out_index, &ghost->hash_elem) == NULL)
+        list_push_back(&a1out_queue, &ghost->elem);
+      else
+        list_push_back(&ghost_free, &ghost->elem);
+    }
+  }
+  cache_block->policy_queue = TWOQ_NONE;
+}
+
+
+/* replaces the oldest block of a1in_queue while it is larger than its
+   share, otherwise the least recently used block of am_queue */
+static struct cache_block*
+twoq_select_victim(void) {
+  struct cache_block *victim = NULL;
+  if (a1in_cnt > a1in_max || list_empty(&am_queue)) {
+    victim = twoq_scan_queue(&a1in_queue);
+    if (victim == NULL)
+      victim = twoq_scan_queue(&am_queue);
+  } else {
+    victim = twoq_scan_queue(&am_queue);
+    if (victim == NULL)
+      victim = twoq_scan_queue(&a1in_queue);
   }
+  return victim;
+}
+
+
+/* returns the first evictable block of queue with its cache_field_lock
+   held, or NULL */
+static struct cache_block*
+twoq_scan_queue(struct list *queue) {
+  struct list_elem *e;
+  for (e = list_begin(queue); e != list_end(queue); e = list_next(e)) {
+    struct cache_block *cache_block =
+      list_entry(e, struct cache_block, policy_elem);
+    lock_acquire(&cache_block->cache_field_lock);
+    if (cache_block_evictable(cache_block))
+      return cache_block;
+    lock_release(&cache_block->cache_field_lock);
+  }
+  return NULL;
+}
+
+
+/* hash function of the ghost index */
+static unsigned
+ghost_hash(const struct hash_elem *e, void *aux UNUSED) {
+  return hash_int(hash_entry(e, struct cache_ghost, hash_elem)->disk_sector);
 }
 
-/* function used by thread to read ahead */
+
+/* comparison function of the ghost index */
+static bool
+ghost_less(const struct hash_elem *a, const struct hash_elem *b,
+ void *aux UNUSED) {
+  return hash_entry(a, struct cache_ghost, hash_elem)->disk_sector
+         < hash_entry(b, struct cache_ghost, hash_elem)->disk_sector;
+}
+
+/* function used by thread to read ahead. The reads are submitted to the
+   disk without waiting for them, so that the disk queue sees the whole
+   read-ahead window and merges the reads of adjacent sectors */
 void
 filesys_read_ahead_thread(void *aux UNUSED) {
   while (true) {
       sema_down(&read_ahead_semaphore);
       lock_acquire(&read_ahead_lock);
-      struct list_elem *head = list_pop_front(&read_ahead_queue);
+      block_sector_t disk_sector = read_ahead_queue[read_ahead_queue_head];
+      read_ahead_queue_head =
+        (read_ahead_queue_head + 1) % READ_AHEAD_QUEUE_SIZE;
       read_ahead_queue_size -= 1;
       lock_release(&read_ahead_lock);
-      struct read_ahead_entry *read_ahead_entry = 
-        list_entry(head, struct read_ahead_entry, elem);
-      filesys_cache_access(read_ahead_entry->disk_sector, false, true);
-      free(read_ahead_entry);
+
+      read_ahead_sector(disk_sector);
     }
 }
 
 
-/* function used to add entry to the read ahead list */
-void
+/* reserves a block for disk_sector unless it is cached already and submits
+   the read of its content. Threads which need the sector meanwhile wait
+   for the read like for any other read in progress */
+static void
+read_ahead_sector(block_sector_t disk_sector) {
+  bool reserved;
+  struct cache_block *cache_block =
+    cache_block_reserve(disk_sector, false, &reserved);
+  if (!reserved) {
+    lock_release(&cache_block->cache_field_lock);
+    return;
+  }
+
+  block_request_init(&cache_block->request, false, disk_sector, 1,
+                     cache_block->cached_content, read_ahead_done,
+                     cache_block);
+  block_submit(fs_device, &cache_block->request);
+}
+
+
+/* completes the read ahead of cache_block, called by the thread of the
+   disk */
+static void
+read_ahead_done(struct block_request *request UNUSED, void *cache_block_) {
+  struct cache_block *cache_block = cache_block_;
+  cache_block_read_done(cache_block);
+  lock_release(&cache_block->cache_field_lock);
+}
+
+
+/* function used to add entry to the read ahead queue. Returns false if
+   disk_sector was not queued because the queue is full (or the sector is
+   invalid), the caller has to queue it again later on */
+bool
 filesys_cache_queue_read_ahead(block_sector_t disk_sector) {
-  /* return if invalid sector */
-  if (!verify_sector(fs_device, disk_sector) && disk_sector != 0)
-      return;
+  if (!verify_sector(fs_device, disk_sector))
+    return false;
 
-  /* return if queue is already full */
   lock_acquire(&read_ahead_lock);
-  if (read_ahead_queue_size >= MAX_READ_AHEAD_SIZE) {
+  if (read_ahead_queue_size >= READ_AHEAD_QUEUE_SIZE) {
     lock_release(&read_ahead_lock);
-    return;
+    return false;
   }
 
-  struct read_ahead_entry *read_ahead_entry = malloc(
-    sizeof(struct read_ahead_entry));
-  read_ahead_entry->disk_sector = disk_sector;
-  list_push_back(&read_ahead_queue, &read_ahead_entry->elem);
+  int tail = (read_ahead_queue_head + read_ahead_queue_size)
+             % READ_AHEAD_QUEUE_SIZE;
+  read_ahead_queue[tail] = disk_sector;
   read_ahead_queue_size += 1;
   lock_release(&read_ahead_lock);
   sema_up(&read_ahead_semaphore);
+  return true;
 }
 
 
-/* function called periodically
-   to write cache back to disk if dirty, runs into OPPOSITE direction of 
-   evict to avoid slowdown caused by locking iteratively over array */
+/* writes all dirty blocks back to disk */
 void
 filesys_cache_writeback() {
+  cache_writeback_dirty_before(INT64_MAX);
+}
+
+
+/* writes the blocks back to disk which became dirty at or before the timer
+   tick dirty_before. The dirty blocks are collected
+   first and sorted by sector, so that each run of adjacent sectors is
+   written with a single request instead of one write per block in cache
+   order. Each block of a run is copied
+   into a snapshot under its shared content_lock and stays pinned until the
+   run is written, no lock is held during the disk I/O. Writers of a block
+   can continue meanwhile and make it dirty again. The request of a run is
+   submitted without waiting for it, the pass only waits once it needs the
+   buffers of the run again or when it ends */
+static void
+cache_writeback_dirty_before(int64_t dirty_before) {
+  lock_acquire(&writeback_lock);
 
   lock_acquire(&filesys_cache_lock);
-  int iterator = next_free_cache - 1;
+  int used_cnt = next_free_cache;
   lock_release(&filesys_cache_lock);
 
-  while (iterator >= 0) {
-    struct cache_block *iterator_block = cache_array[iterator];
-    
+  /* collect dirty blocks */
+  size_t entry_cnt = 0;
+  int iterator = 0;
+  for (iterator = 0; iterator < used_cnt; iterator++) {
+    struct cache_block *iterator_block = &cache_array[iterator];
     lock_acquire(&iterator_block->cache_field_lock);
+    /* blocks under I/O are either read in or written back already */
+    if (iterator_block->dirty && !iterator_block->io_in_progress
+        && iterator_block->dirty_since <= dirty_before) {
+      writeback_entries[entry_cnt].disk_sector = iterator_block->disk_sector;
+      writeback_entries[entry_cnt].cache_block = iterator_block;
+      entry_cnt += 1;
+    }
+    lock_release(&iterator_block->cache_field_lock);
+  }
+
+  qsort(writeback_entries, entry_cnt, sizeof *writeback_entries,
+        writeback_entry_compare);
 
-    if (iterator_block->dirty){
-      block_write(fs_device, iterator_block->disk_sector,
-       &iterator_block->cached_content);
-      iterator_block->dirty = false;
+  /* write runs of adjacent sectors */
+  size_t entry_index = 0;
+  size_t run_index = 0;
+  while (entry_index < entry_cnt) {
+    struct writeback_run *run = &writeback_runs[run_index];
+    writeback_run_finish(run);
+
+    block_sector_t run_start = writeback_entries[entry_index].disk_sector;
+    while (entry_index < entry_cnt && run->cnt < WRITEBACK_RUN_SECTORS) {
+      struct writeback_entry *entry = &writeback_entries[entry_index];
+      if (entry->disk_sector != run_start + run->cnt)
+        break;
+      entry_index += 1;
+      if (!writeback_snapshot(entry->cache_block, entry->disk_sector,
+                              run->snapshots
+                              + run->cnt * BLOCK_SECTOR_SIZE))
+        break;
+      run->blocks[run->cnt] = entry->cache_block;
+      run->cnt += 1;
     }
 
-    lock_release(&iterator_block->cache_field_lock);
-    iterator -= 1;
+    if (run->cnt > 0) {
+      block_request_init(&run->request, true, run_start, run->cnt,
+                         run->snapshots, NULL, NULL);
+      block_submit(fs_device, &run->request);
+      run->pending = true;
+      run_index = (run_index + 1) % WRITEBACK_RUNS;
+    }
+  }
+
+  for (run_index = 0; run_index < WRITEBACK_RUNS; run_index++)
+    writeback_run_finish(&writeback_runs[run_index]);
+
+  lock_release(&writeback_lock);
+}
+
+
+/* waits until the request of run is written if it was submitted and
+   unpins its blocks, so that the run can be used again */
+static void
+writeback_run_finish(struct writeback_run *run) {
+  if (run->pending) {
+    block_wait(&run->request);
+    run->pending = false;
+  }
+
+  size_t i = 0;
+  for (i = 0; i < run->cnt; i++)
+    filesys_cache_unpin(run->blocks[i], false);
+  run->cnt = 0;
+}
+
+
+/* orders writeback entries by sector */
+static int
+writeback_entry_compare(const void *a, const void *b) {
+  const struct writeback_entry *entry_a = a;
+  const struct writeback_entry *entry_b = b;
+  if (entry_a->disk_sector < entry_b->disk_sector)
+    return -1;
+  return entry_a->disk_sector > entry_b->disk_sector;
+}
+
+
+/* copies the content of cache_block into snapshot and pins it, if it still
+   caches disk_sector and is dirty. The dirty bit is cleared before copying,
+   a write during the I/O makes the block dirty again. Returns false if the
+   block does not have to be written back anymore */
+static bool
+writeback_snapshot(struct cache_block *cache_block, block_sector_t disk_sector,
+ uint8_t *snapshot) {
+  lock_acquire(&cache_block->cache_field_lock);
+  if (cache_block->disk_sector != disk_sector || !cache_block->dirty
+      || cache_block->io_in_progress) {
+    lock_release(&cache_block->cache_field_lock);
+    return false;
+  }
+  cache_block_mark_clean(cache_block);
+  cache_block->pin_cnt += 1;
+  lock_release(&cache_block->cache_field_lock);
+
+  rw_lock_acquire_shared(&cache_block->content_lock);
+  memcpy(snapshot, cache_block->cached_content, BLOCK_SECTOR_SIZE);
+  rw_lock_release_shared(&cache_block->content_lock);
+  return true;
+}
+
+
+/* marks cache_block dirty, the caller has to hold its cache_field_lock.
+   Wakes the writeback timer for the first dirty block and the flusher once
+   dirty_high_water blocks are dirty */
+static void
+cache_block_mark_dirty(struct cache_block *cache_block) {
+  ASSERT(lock_held_by_current_thread(&cache_block->cache_field_lock));
+  if (cache_block->dirty)
+    return;
+  cache_block->dirty = true;
+  cache_block->dirty_since = timer_ticks();
+
+  lock_acquire(&dirty_lock);
+  dirty_cnt += 1;
+  if (dirty_cnt == 1)
+    cond_signal(&dirty_cond, &dirty_lock);
+  if (dirty_cnt == dirty_high_water) {
+    flush_requested = true;
+    cond_signal(&flush_cond, &dirty_lock);
   }
+  lock_release(&dirty_lock);
+}
+
+
+/* marks cache_block clean, the caller has to hold its cache_field_lock */
+static void
+cache_block_mark_clean(struct cache_block *cache_block) {
+  ASSERT(lock_held_by_current_thread(&cache_block->cache_field_lock));
+  if (!cache_block->dirty)
+    return;
+  cache_block->dirty = false;
+
+  lock_acquire(&dirty_lock);
+  ASSERT(dirty_cnt > 0);
+  dirty_cnt -= 1;
+  lock_release(&dirty_lock);
 }
 
 
-/* function which is executed by asynchronous thread and causes a call of
-   filesys_cache_writeback every WRITE_BACK_INTERVAL milliseconds */
+/* function which is executed by an asynchronous thread, the flusher. It
+   sleeps until a flush is requested, either by the writeback timer or early
+   once dirty_high_water blocks are dirty. In the latter case every dirty
+   block is written back, otherwise only blocks older than DIRTY_AGE_LIMIT */
 void filesys_cache_periodic_writeback(void* aux UNUSED) {
   while (true) {
-    timer_msleep(WRITE_BACK_INTERVAL);
-    filesys_cache_writeback();
+    lock_acquire(&dirty_lock);
+    while (!flush_requested)
+      cond_wait(&flush_cond, &dirty_lock);
+    flush_requested = false;
+    bool urgent = dirty_cnt >= dirty_high_water;
+    lock_release(&dirty_lock);
+
+    if (urgent)
+      cache_writeback_dirty_before(INT64_MAX);
+    else
+      cache_writeback_dirty_before(timer_ticks()
+                                   - DIRTY_AGE_LIMIT * TIMER_FREQ / 1000);
+  }
+}
+
+
+/* function which is executed by an asynchronous thread and requests a flush
+   every DIRTY_CHECK_INTERVAL ms while blocks are dirty. Sleeps until a block
+   becomes dirty otherwise */
+void filesys_cache_writeback_timer(void* aux UNUSED) {
+  while (true) {
+    lock_acquire(&dirty_lock);
+    while (dirty_cnt == 0)
+      cond_wait(&dirty_cond, &dirty_lock);
+    lock_release(&dirty_lock);
+
+    timer_msleep(DIRTY_CHECK_INTERVAL);
+
+    lock_acquire(&dirty_lock);
+    flush_requested = true;
+    cond_signal(&flush_cond, &dirty_lock);
+    lock_release(&dirty_lock);
   }
 }
@@ -1,21 +1,41 @@
 #ifndef FILESYS_CACHE_H
 #define FILESYS_CACHE_H
 
+#include <hash.h>
 #include "devices/block.h"
 #include "threads/synch.h"
 #include "filesys/off_t.h"
 
-/* defines the maximal number of cache entries */
-#define CACHE_SIZE 64
+/* default number of cache entries (512 KB), can be changed with the
+   -cache=SECTORS kernel command line option. Cut down to
+   CACHE_DEFAULT_PAGES_PERCENT of the free kernel pages on small machines */
+#define CACHE_DEFAULT_SIZE 1024
+#define CACHE_DEFAULT_PAGES_PERCENT 25
+/* largest share of the free kernel pages a size given with -cache may
+   take, larger sizes are refused at boot */
+#define CACHE_MAX_PAGES_PERCENT 50
+/* smallest number of cache entries the cache works with */
+#define CACHE_MIN_SIZE 16
 
-/* write back every second */
-#define WRITE_BACK_INTERVAL 1000
+/* number of cache entries, 0 for the default size. Set before
+   filesys_cache_init is called, holds the actual size afterwards */
+extern size_t filesys_cache_size;
+/* name of the replacement policy, set before filesys_cache_init is called */
+extern const char *filesys_cache_policy_name;
+
+/* dirty blocks are written back once they have been dirty for
+DIRTY_AGE_LIMIT ms, their age is checked every DIRTY_CHECK_INTERVAL ms while
+any block is dirty */
+#define DIRTY_AGE_LIMIT 1000
+#define DIRTY_CHECK_INTERVAL 250
+/* percentage of dirty cache blocks at which all dirty blocks are written
+back without waiting for them to age */
+#define DIRTY_HIGH_WATER_PERCENT 25
 
 /* lock to lock the complete cache used e.g. to ensure that create is
-atomic and the is no race to set the next free cache*/
+atomic and the is no race to set the next free cache. Never held during
+disk I/O */
 struct lock filesys_cache_lock;
-/* used to ensure that only 1 thread at a time can evict a page */
-struct lock filesys_cache_evict_lock;
 
 struct cache_block {
   /* METADATA */
@@ -23,24 +43,53 @@ struct cache_block {
   bool accessed;
   /* inidicates if the cache block is dirty (used for write behind) */ 
   bool dirty;
+  /* timer tick at which the block became dirty */
+  int64_t dirty_since;
   /* counts how often the page is accessed increment on every read, write and
-  access */ 
+  access (used by the clock policy) */ 
   int accessed_counter;
 
-  /* indicates if a reader or writer is currently using the block and how many;
-  increment at start of read/write and decrement on exit of read/write */
-  int read_writer_working;
+  /* replacement policy state, protected by filesys_cache_lock: element in
+  one of the policy's queues, the queue and the time it was queued */
+  struct list_elem policy_elem;
+  int policy_queue;
+  unsigned policy_stamp;
+  /* true while the block was cached by read-ahead and not yet hit by a
+  demand lookup, whose hit then counts as the first reference */
+  bool prefetched;
+
+  /* number of threads which pinned the block with filesys_cache_pin; a
+  pinned block keeps its disk_sector and is never evicted */
+  int pin_cnt;
 
   /* lock used to lock metadata updates */
   struct lock cache_field_lock;
 
-  /* Cached content + disk sector */
-  uint8_t cached_content[BLOCK_SECTOR_SIZE];
+  /* true while the block is read from or written back to disk without
+  filesys_cache_lock being held; the content must not be used meanwhile */
+  bool io_in_progress;
+  /* signalled (with cache_field_lock) when io_in_progress is cleared */
+  struct condition io_done;
+  /* request of an asynchronous read into the block while io_in_progress */
+  struct block_request request;
+
+  /* protects cached_content: held shared while copying out of the block
+  and exclusive while copying into it */
+  struct rw_lock content_lock;
+
+  /* Cached content + disk sector; cached_content points into the
+  preallocated cache arena and never changes */
+  uint8_t *cached_content;
   block_sector_t disk_sector;
+
+  /* element in the sector index, keyed by disk_sector; only modified while
+  filesys_cache_lock is held */
+  struct hash_elem hash_elem;
 };
 
-/* structure(array) to store cache blocks */
-struct cache_block *cache_array[CACHE_SIZE];
+/* structure(array) to store the metadata of filesys_cache_size cache blocks,
+   the cached data itself lives in a separate page-aligned arena */
+struct cache_block *cache_array;
 
 /* indicates the next free block in the cache */
 int next_free_cache;
@@ -50,10 +99,16 @@ int next_evict_cache;
 
 
 void filesys_cache_init(void);
+struct cache_block *filesys_cache_pin(block_sector_t disk_sector);
+void filesys_cache_unpin(struct cache_block *cache_block, bool dirty);
 void filesys_cache_read(block_sector_t disk_sector, void *buffer,
  off_t sector_offset, int chunk_size);
 void filesys_cache_write(block_sector_t disk_sector, void *buffer,
  off_t sector_offset, int chunk_size);
+void filesys_cache_zero(block_sector_t disk_sector);
+void *filesys_cache_get(block_sector_t disk_sector, bool exclusive);
+void filesys_cache_put(const void *content, bool dirty);
+bool filesys_cache_queue_read_ahead(block_sector_t disk_sector);
 void filesys_cache_writeback(void);
 
 #endif
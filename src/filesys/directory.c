@@ -1,9 +1,14 @@
 #include "filesys/directory.h"
+#include <dirent.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
+#include <hash.h>
 #include <list.h>
+#include <round.h>
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/cache.h"
 #include "threads/malloc.h"
 #include "threads/thread.h"
 
@@ -12,16 +17,286 @@ struct dir
   {
     struct inode *inode;                /* Backing store. */
     off_t pos;                          /* Current position. */
+    bool hashed;                        /* in the hashed format? */
   };
 
-/* A single directory entry. */
+/* A directory consists of blocks of variable-length records, one per
+   entry. The records of a block fill its first DIR_RECORDS_SIZE bytes
+   exactly and never cross a block boundary: a record owns the slack
+   behind its name, a new entry is put into the slack of a record which
+   has enough, and a removed record is merged into the one before it. Only
+   the first record of a block can therefore be free. */
+
+/* On-disk directory record. */
+struct dir_record
+  {
+    block_sector_t inode_sector;        /* Sector number of header. */
+    unsigned hash;                      /* hash_string() of the name */
+    uint16_t reclen;                    /* bytes to the next record */
+    uint8_t name_len;                   /* length of the name */
+    uint8_t type;                       /* enum dir_record_type */
+    char name[];                        /* name, not null terminated */
+  };
+
+/* Type of a directory record. The type of the file is kept in the record,
+   so that listing a directory does not open the inode of every entry. */
+enum dir_record_type
+  {
+    DIR_RECORD_FREE,                    /* free record */
+    DIR_RECORD_FILE,                    /* ordinary file */
+    DIR_RECORD_DIR                      /* directory */
+  };
+
+/* bytes of a directory block holding records */
+#define DIR_RECORDS_SIZE (BLOCK_SECTOR_SIZE - sizeof (uint32_t))
+
+/* bytes used by a record with a name of NAME_LEN characters */
+#define DIR_RECORD_SIZE(NAME_LEN) \
+  ROUND_UP (offsetof (struct dir_record, name) + (NAME_LEN), 4)
+
+/* block of a directory */
+struct dir_block
+  {
+    uint8_t records[DIR_RECORDS_SIZE];  /* struct dir_record, packed */
+    uint32_t next;                      /* overflow block of a bucket in the
+                                           hashed format, 0 if none */
+  };
+
+/* A single directory entry, as copied out of its record. The name is
+   copied into a buffer of the caller, so that no NAME_MAX sized buffer
+   ends up on the kernel stack of every function searching a directory. */
 struct dir_entry 
   {
     block_sector_t inode_sector;        /* Sector number of header. */
-    char name[NAME_MAX + 1];            /* Null terminated file name. */
-    bool in_use;                        /* In use or free? */
+    bool is_dir;                        /* is the entry a directory? */
+    char *name;                         /* NAME_MAX + 1 bytes receiving the
+                                           null terminated file name, empty
+                                           for a free record, or a null
+                                           pointer if it is not needed. */
+  };
+
+/* A name searched for, with its length and hash. */
+struct dir_key
+  {
+    const char *name;                   /* null terminated name */
+    size_t len;                         /* length of the name */
+    unsigned hash;                      /* hash_string() of the name */
+  };
+
+
+/* A directory in the hashed format starts with a header block followed by
+   bucket blocks. The entries are distributed over the buckets by the hash
+   of their name with linear hashing: a bucket is split into two whenever
+   an insertion has to chain an overflow block to a bucket, so that the
+   number of buckets grows with the directory and a lookup reads the header
+   and about one bucket block. */
+
+/* marks the header in the first word of a directory in the hashed format.
+   The format itself is noted in the inode of the directory, so that
+   opening a directory does not read its first block */
+#define DIR_HASHED_MAGIC 0x48444952
+
+/* number of buckets the header can refer to. Buckets are not split any
+   further when it is full, so their chains grow instead */
+#define DIR_MAX_BUCKETS (BLOCK_SECTOR_SIZE / sizeof (uint32_t) - 4)
+
+/* header in the first block of a directory in the hashed format */
+struct dir_header
+  {
+    uint32_t magic;                     /* DIR_HASHED_MAGIC */
+    uint32_t bucket_cnt;                /* number of buckets */
+    uint32_t round_cnt;                 /* number of buckets when the
+                                           current round of splits started */
+    uint32_t block_cnt;                 /* number of blocks in the file */
+    uint32_t buckets[DIR_MAX_BUCKETS];  /* first block of each bucket */
+  };
+
+/* create new directories in the hashed format */
+bool dir_use_hashed;
+
+
+/* Cached result of looking up NAME in the directory in sector PARENT, so
+   that resolving a path again does not scan the directories on it. */
+struct dentry
+  {
+    struct hash_elem hash_elem;         /* element in dentries */
+    struct list_elem lru_elem;          /* element in dentry_lru */
+    block_sector_t parent;              /* sector of the directory */
+    block_sector_t sector;              /* sector of the inode of NAME, 0 if
+                                           the directory has no such entry */
+    const char *name;                   /* null terminated file name, stored
+                                           behind the dentry */
   };
 
+/* maximal number of cached dentries */
+#define DENTRY_CACHE_MAX 256
+
+static struct hash dentries;            /* dentries by parent and name */
+static struct list dentry_lru;          /* dentries, least recently used
+                                           first */
+static struct lock dentry_lock;         /* protects dentries and dentry_lru */
+
+static bool dentry_lookup (block_sector_t parent, const char *name,
+                           block_sector_t *sectorp);
+static void dentry_set (block_sector_t parent, const char *name,
+                        block_sector_t sector);
+static void dentry_purge_dir (block_sector_t parent);
+
+
+/* selects which directory entries dir_scan returns */
+enum dir_scan_match
+  {
+    MATCH_NAME,                         /* in use entry with a given name */
+    MATCH_IN_USE,                       /* any in use entry */
+    MATCH_FREE                          /* record with room for a given
+                                           name */
+  };
+
+static bool dir_scan (const struct dir *dir, off_t ofs,
+                      enum dir_scan_match match, const struct dir_key *key,
+                      struct dir_entry *ep, off_t *ofsp);
+static bool lookup_hashed (const struct dir *dir, const struct dir_key *key,
+                           struct dir_entry *ep, off_t *ofsp);
+static bool add_hashed (struct dir *dir, const struct dir_key *key,
+                        block_sector_t inode_sector, bool is_dir);
+static bool append_bucket_block (struct dir *dir, struct dir_header *header,
+                                 uint32_t *blockp);
+
+
+/* returns the hash of the parent and name of dentry E */
+static unsigned
+dentry_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct dentry *d = hash_entry (e, struct dentry, hash_elem);
+  return hash_int (d->parent) ^ hash_string (d->name);
+}
+
+/* orders dentries A and B by parent and name */
+static bool
+dentry_less (const struct hash_elem *a_, const struct hash_elem *b_,
+             void *aux UNUSED)
+{
+  const struct dentry *a = hash_entry (a_, struct dentry, hash_elem);
+  const struct dentry *b = hash_entry (b_, struct dentry, hash_elem);
+  if (a->parent != b->parent)
+    return a->parent < b->parent;
+  return strcmp (a->name, b->name) < 0;
+}
+
+/* Initializes the directory module. */
+void
+dir_init (void)
+{
+  hash_init (&dentries, dentry_hash, dentry_less, NULL);
+  list_init (&dentry_lru);
+  lock_init (&dentry_lock);
+}
+
+/* returns the cached dentry for NAME in PARENT or a null pointer.
+   dentry_lock must be held */
+static struct dentry *
+dentry_find (block_sector_t parent, const char *name)
+{
+  struct dentry key;
+  struct hash_elem *e;
+
+  key.parent = parent;
+  key.name = name;
+  e = hash_find (&dentries, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct dentry, hash_elem) : NULL;
+}
+
+/* Looks up NAME in the directory in sector PARENT in the dentry cache.
+   Returns false if it is not cached. Otherwise sets *SECTORP to the sector
+   of the inode of NAME, 0 if the directory has no entry NAME, and returns
+   true. */
+static bool
+dentry_lookup (block_sector_t parent, const char *name,
+               block_sector_t *sectorp)
+{
+  struct dentry *d;
+
+  if (strlen (name) > NAME_MAX)
+    return false;
+
+  lock_acquire (&dentry_lock);
+  d = dentry_find (parent, name);
+  if (d != NULL)
+    {
+      list_remove (&d->lru_elem);
+      list_push_back (&dentry_lru, &d->lru_elem);
+      *sectorp = d->sector;
+    }
+  lock_release (&dentry_lock);
+  return d != NULL;
+}
+
+/* Caches that NAME in the directory in sector PARENT refers to the inode in
+   SECTOR, or that there is no entry NAME if SECTOR is 0. Evicts the least
+   recently used dentry if the cache is full. The directory must be locked
+   while its entries are looked up or changed, so that a concurrent change
+   cannot be overwritten with an outdated result. */
+static void
+dentry_set (block_sector_t parent, const char *name, block_sector_t sector)
+{
+  struct dentry *d;
+
+  if (strlen (name) > NAME_MAX)
+    return;
+
+  lock_acquire (&dentry_lock);
+  d = dentry_find (parent, name);
+  if (d != NULL)
+    list_remove (&d->lru_elem);
+  else
+    {
+      /* the cache is only an optimization, nothing is cached without
+         memory */
+      size_t name_size = strlen (name) + 1;
+      d = malloc (sizeof *d + name_size);
+      if (d == NULL)
+        {
+          lock_release (&dentry_lock);
+          return;
+        }
+      d->parent = parent;
+      d->name = memcpy (d + 1, name, name_size);
+      hash_insert (&dentries, &d->hash_elem);
+      if (hash_size (&dentries) > DENTRY_CACHE_MAX)
+        {
+          struct dentry *victim = list_entry (list_pop_front (&dentry_lru),
+                                              struct dentry, lru_elem);
+          hash_delete (&dentries, &victim->hash_elem);
+          free (victim);
+        }
+    }
+  d->sector = sector;
+  list_push_back (&dentry_lru, &d->lru_elem);
+  lock_release (&dentry_lock);
+}
+
+/* Drops the dentries of the directory in sector PARENT, which is created
+   anew in a sector that may have belonged to a removed directory. */
+static void
+dentry_purge_dir (block_sector_t parent)
+{
+  struct list_elem *e;
+
+  lock_acquire (&dentry_lock);
+  for (e = list_begin (&dentry_lru); e != list_end (&dentry_lru); )
+    {
+      struct dentry *d = list_entry (e, struct dentry, lru_elem);
+      e = list_next (e);
+      if (d->parent == parent)
+        {
+          list_remove (&d->lru_elem);
+          hash_delete (&dentries, &d->hash_elem);
+          free (d);
+        }
+    }
+  lock_release (&dentry_lock);
+}
+
 
 /*  IMPORTANT: Paths are not allowed to end with / in string!!! */
 /*  Make sure to create and free path/file_name whenever this function is used! 
@@ -201,12 +476,54 @@ dir_open_path(const char* path)
 }
 
 
-/* Creates a directory with space for ENTRY_CNT entries in the
-   given SECTOR.  Returns true if successful, false on failure. */
+/* Creates an empty directory in the given SECTOR.  Returns true if
+   successful, false on failure.  A directory in the linear format
+   starts without any block, its first block of records is appended
+   by the first dir_add(); one in the hashed format starts with the
+   header and a single empty bucket block. */
+bool
+dir_create (block_sector_t sector)
+{
+  dentry_purge_dir (sector);
+  if (!inode_create (sector, 0, true))
+    return false;
+  if (!dir_use_hashed)
+    return true;
+
+  ASSERT (sizeof (struct dir_header) == BLOCK_SECTOR_SIZE);
+  ASSERT (sizeof (struct dir_block) == BLOCK_SECTOR_SIZE);
+
+  struct dir_header *header = calloc (1, sizeof *header);
+  if (header == NULL)
+    return false;
+
+  header->magic = DIR_HASHED_MAGIC;
+  header->bucket_cnt = 1;
+  header->round_cnt = 1;
+  header->block_cnt = 1;
+  bool success = false;
+  struct inode *inode = inode_open (sector);
+  struct dir *dir = dir_open (inode);
+  if (dir == NULL)
+    inode_close (inode);
+  else if (append_bucket_block (dir, header, &header->buckets[0])
+           && inode_write_at (inode, header, sizeof *header, 0)
+                == sizeof *header)
+    {
+      inode_set_dir_hashed (inode);
+      success = true;
+    }
+  dir_close (dir);
+  free (header);
+  return success;
+}
+
+/* Creates the root directory in the given SECTOR and opens it.
+   Returns a null pointer on failure. */
 struct dir*
-dir_create_root (block_sector_t sector, size_t entry_cnt)
+dir_create_root (block_sector_t sector)
 {
-  if (!inode_create (sector, entry_cnt * sizeof (struct dir_entry), true))
+  if (!dir_create (sector))
     return NULL;
 
   struct inode *root_inode = inode_open (sector);
@@ -224,6 +541,138 @@ dir_create_root (block_sector_t sector, size_t entry_cnt)
   return root;
 }
 
+/* maximal length of a name in the fixed-size entries */
+#define DIR_SLOT_NAME_MAX 14
+
+/* Directory entry of the fixed-size format of earlier versions, whose
+   directories were arrays of these entries. */
+struct dir_slot
+  {
+    block_sector_t inode_sector;        /* Sector number of header. */
+    char name[DIR_SLOT_NAME_MAX + 1];   /* Null terminated file name. */
+    bool in_use;                        /* In use or free? */
+  };
+
+/* Rewrites the directory INODE from the fixed-size entries of earlier
+   versions into blocks of records in the linear format and marks it as
+   converted. The sectors of the entries are appended to *SECTORSP, which
+   holds *CNTP sectors, so that the caller converts the subdirectories as
+   well. Returns false if memory allocation or writing fails. */
+static bool
+convert_slots (struct inode *inode, block_sector_t **sectorsp, size_t *cntp)
+{
+  off_t length = inode_length (inode);
+  size_t slot_cnt = length / sizeof (struct dir_slot);
+  struct dir_slot *slots = malloc (length + 1);
+  struct dir_record *last = NULL;
+  size_t block_cnt, block = 0, rec_ofs = 0, i;
+  uint8_t *blocks;
+  bool success = false;
+
+  if (slots == NULL)
+    return false;
+  if (inode_read_at (inode, slots, length, 0) != length)
+    goto done;
+
+  /* every block holds at least DIR_RECORDS_SIZE / DIR_RECORD_SIZE
+     (DIR_SLOT_NAME_MAX) records, and the directory does not shrink, so
+     that no block is left with slots behind the records */
+  block_cnt = DIV_ROUND_UP (slot_cnt, DIR_RECORDS_SIZE
+                                      / DIR_RECORD_SIZE (DIR_SLOT_NAME_MAX));
+  if (block_cnt < DIV_ROUND_UP ((size_t) length, BLOCK_SECTOR_SIZE))
+    block_cnt = DIV_ROUND_UP ((size_t) length, BLOCK_SECTOR_SIZE);
+  blocks = calloc (block_cnt, BLOCK_SECTOR_SIZE);
+  if (blocks == NULL)
+    goto done;
+
+  /* records are packed into the blocks, the last record of a block owns
+     the rest of it. A block without records is a single free record */
+  for (i = 0; i < slot_cnt; i++)
+    {
+      const struct dir_slot *slot = &slots[i];
+      if (!slot->in_use)
+        continue;
+
+      size_t name_len = strnlen (slot->name, DIR_SLOT_NAME_MAX);
+      size_t size = DIR_RECORD_SIZE (name_len);
+      struct inode *child = inode_open (slot->inode_sector);
+      bool is_dir = child != NULL && inode_is_directory (child);
+      inode_close (child);
+      if (rec_ofs + size > DIR_RECORDS_SIZE)
+        {
+          last->reclen += DIR_RECORDS_SIZE - rec_ofs;
+          block++;
+          rec_ofs = 0;
+        }
+      ASSERT (block < block_cnt);
+      last = (struct dir_record *) (blocks + block * BLOCK_SECTOR_SIZE
+                                    + rec_ofs);
+      last->inode_sector = slot->inode_sector;
+      last->hash = hash_string (slot->name);
+      last->reclen = size;
+      last->name_len = name_len;
+      last->type = is_dir ? DIR_RECORD_DIR : DIR_RECORD_FILE;
+      memcpy (last->name, slot->name, name_len);
+      rec_ofs += size;
+
+      block_sector_t *sectors = realloc (*sectorsp,
+                                         (*cntp + 1) * sizeof **sectorsp);
+      if (sectors == NULL)
+        goto done_blocks;
+      sectors[(*cntp)++] = slot->inode_sector;
+      *sectorsp = sectors;
+    }
+  if (last != NULL)
+    {
+      last->reclen += DIR_RECORDS_SIZE - rec_ofs;
+      block++;
+    }
+  for (; block < block_cnt; block++)
+    ((struct dir_record *) (blocks + block * BLOCK_SECTOR_SIZE))->reclen
+      = DIR_RECORDS_SIZE;
+
+  if (inode_write_at (inode, blocks, block_cnt * BLOCK_SECTOR_SIZE, 0)
+      == (off_t) (block_cnt * BLOCK_SECTOR_SIZE))
+    {
+      inode_set_dir_records (inode);
+      success = true;
+    }
+
+ done_blocks:
+  free (blocks);
+ done:
+  free (slots);
+  return success;
+}
+
+/* Converts the directories of a file system written by an earlier version,
+   whose root directory still holds fixed-size entries, to the records of
+   the linear format. Directories are converted from the root down, a
+   directory which is converted already is skipped together with its
+   subdirectories. Returns false if memory allocation or writing fails. */
+bool
+dir_convert_slots (void)
+{
+  block_sector_t *sectors = malloc (sizeof *sectors);
+  size_t cnt = 0;
+  bool success = true;
+
+  if (sectors == NULL)
+    return false;
+  sectors[cnt++] = ROOT_DIR_SECTOR;
+  while (success && cnt > 0)
+    {
+      struct inode *inode = inode_open (sectors[--cnt]);
+      if (inode == NULL)
+        success = false;
+      else if (inode_is_directory (inode) && inode_has_old_dir_format (inode))
+        success = convert_slots (inode, &sectors, &cnt);
+      inode_close (inode);
+    }
+  free (sectors);
+  return success;
+}
+
 /* Opens and returns the directory for the given INODE, of which
    it takes ownership.  Returns a null pointer on failure. */
 struct dir *
@@ -235,6 +684,7 @@ dir_open (struct inode *inode)
     {
       dir->inode = inode;
       dir->pos = 0;
+      dir->hashed = inode_has_hashed_dir_format (inode);
       return dir;
     }
   else
@@ -281,34 +731,431 @@ dir_get_inode (struct dir *dir)
   return dir->inode;
 }
 
-/* Searches DIR for a file with the given NAME.
+/* initializes KEY for searching NAME */
+static void
+dir_key_init (struct dir_key *key, const char *name)
+{
+  key->name = name;
+  key->len = strlen (name);
+  key->hash = hash_string (name);
+}
+
+/* returns the number of bytes of record R which a new record can use */
+static size_t
+record_room (const struct dir_record *r)
+{
+  return r->reclen - (r->type != DIR_RECORD_FREE
+                      ? DIR_RECORD_SIZE (r->name_len) : 0);
+}
+
+/* returns true if record R is selected by MATCH and KEY. Names are only
+   compared if their hashes and lengths are equal */
+static bool
+record_matches (const struct dir_record *r, enum dir_scan_match match,
+                const struct dir_key *key)
+{
+  switch (match)
+    {
+    case MATCH_NAME:
+      return r->type != DIR_RECORD_FREE && r->hash == key->hash
+             && r->name_len == key->len
+             && !memcmp (r->name, key->name, key->len);
+    case MATCH_IN_USE:
+      return r->type != DIR_RECORD_FREE;
+    case MATCH_FREE:
+      return record_room (r) >= DIR_RECORD_SIZE (key->len);
+    }
+  NOT_REACHED ();
+}
+
+/* Searches the records of the block of DIR at byte offset BLOCK_START for
+   the first record at or after byte offset OFS which is selected by MATCH
+   (and KEY for MATCH_NAME and MATCH_FREE).
+   If successful, returns true, copies the entry to *EP if EP is non-null
+   (without the name if EP->name is null), and sets *OFSP to the byte
+   offset of the record if OFSP is non-null.
+   otherwise, returns false and ignores EP and OFSP. Sets *NEXTP to the
+   next block of the bucket of the block if NEXTP is non-null.
+   Records are compared in place in the buffer cache. A record which does
+   not fit into the block ends the search. */
+static bool
+block_scan (const struct dir *dir, off_t block_start, off_t ofs,
+            enum dir_scan_match match, const struct dir_key *key,
+            struct dir_entry *ep, off_t *ofsp, uint32_t *nextp)
+{
+  const struct dir_block *b = inode_get_sector (dir->inode, block_start);
+  size_t rec_ofs = 0;
+  bool found = false;
+
+  if (nextp != NULL)
+    *nextp = 0;
+  if (b == NULL)
+    return false;
+
+  while (rec_ofs < DIR_RECORDS_SIZE)
+    {
+      const struct dir_record *r =
+        (const struct dir_record *) (b->records + rec_ofs);
+      if (r->reclen < DIR_RECORD_SIZE (0)
+          || r->reclen > DIR_RECORDS_SIZE - rec_ofs
+          || (r->type != DIR_RECORD_FREE
+              && DIR_RECORD_SIZE (r->name_len) > r->reclen))
+        break;
+
+      if (block_start + (off_t) rec_ofs >= ofs
+          && record_matches (r, match, key))
+        {
+          if (ep != NULL)
+            {
+              ep->inode_sector = r->inode_sector;
+              ep->is_dir = r->type == DIR_RECORD_DIR;
+              if (ep->name != NULL)
+                {
+                  size_t name_len = r->type != DIR_RECORD_FREE
+                                    ? r->name_len : 0;
+                  memcpy (ep->name, r->name, name_len);
+                  ep->name[name_len] = '\0';
+                }
+            }
+          if (ofsp != NULL)
+            *ofsp = block_start + rec_ofs;
+          found = true;
+          break;
+        }
+      rec_ofs += r->reclen;
+    }
+
+  if (nextp != NULL)
+    *nextp = b->next;
+  filesys_cache_put (b, false);
+  return found;
+}
+
+/* Searches DIR for the first record at or after byte offset OFS which
+   is selected by MATCH (and KEY for MATCH_NAME and MATCH_FREE), see
+   block_scan().  Records are searched in the order of the blocks, the
+   header of the hashed format is skipped. */
+static bool
+dir_scan (const struct dir *dir, off_t ofs, enum dir_scan_match match,
+          const struct dir_key *key, struct dir_entry *ep, off_t *ofsp)
+{
+  off_t block_start;
+
+  if (dir->hashed && ofs < BLOCK_SECTOR_SIZE)
+    ofs = BLOCK_SECTOR_SIZE;
+
+  for (block_start = ofs - ofs % BLOCK_SECTOR_SIZE;
+       block_start < inode_reader_length (dir->inode);
+       block_start += BLOCK_SECTOR_SIZE)
+    if (block_scan (dir, block_start, ofs, match, key, ep, ofsp, NULL))
+      return true;
+  return false;
+}
+
+/* Searches DIR for a file with the given KEY.
    If successful, returns true, sets *EP to the directory entry
    if EP is non-null, and sets *OFSP to the byte offset of the
    directory entry if OFSP is non-null.
    otherwise, returns false and ignores EP and OFSP. */
 static bool
-lookup (const struct dir *dir, const char *name,
+lookup (const struct dir *dir, const struct dir_key *key,
         struct dir_entry *ep, off_t *ofsp) 
 {
-  struct dir_entry e;
-  size_t ofs;
-  
   ASSERT (dir != NULL);
-  ASSERT (name != NULL);
+  ASSERT (key != NULL);
+
+  if (dir->hashed)
+    return lookup_hashed (dir, key, ep, ofsp);
+  return dir_scan (dir, 0, MATCH_NAME, key, ep, ofsp);
+}
+
+/* Appends a block to DIR at byte offset BLOCK_START, the end of DIR,
+   which consists of a single free record. Returns false if the disk is
+   full. */
+static bool
+append_block (struct dir *dir, off_t block_start)
+{
+  struct dir_record r;
+  uint32_t next = 0;
+
+  memset (&r, 0, sizeof r);
+  r.reclen = DIR_RECORDS_SIZE;
+  return inode_write_at (dir->inode, &next, sizeof next,
+                         block_start + offsetof (struct dir_block, next))
+           == sizeof next
+         && inode_write_at (dir->inode, &r, sizeof r, block_start)
+              == sizeof r;
+}
+
+/* Writes a record for the entry with KEY referring to INODE_SECTOR, a
+   directory if IS_DIR is true, into the record at byte offset OFS of DIR,
+   which must have room for it. An
+   entry is put behind the name of the record if it is in use. The new
+   record is complete before the old one is shortened, so that readers
+   which scan the block meanwhile skip it. Returns false if the disk is
+   full or memory allocation fails. */
+static bool
+record_insert (struct dir *dir, off_t ofs, const struct dir_key *key,
+               block_sector_t inode_sector, bool is_dir)
+{
+  struct dir_record *new;
+  struct dir_record old;
+  size_t used, size = DIR_RECORD_SIZE (key->len);
+  bool written;
+
+  if (inode_read_at (dir->inode, &old, sizeof old, ofs) != sizeof old)
+    return false;
+  used = old.type != DIR_RECORD_FREE ? DIR_RECORD_SIZE (old.name_len) : 0;
+  ASSERT (old.reclen - used >= size);
+
+  new = calloc (1, size);
+  if (new == NULL)
+    return false;
+  new->inode_sector = inode_sector;
+  new->hash = key->hash;
+  new->reclen = old.reclen - used;
+  new->name_len = key->len;
+  new->type = is_dir ? DIR_RECORD_DIR : DIR_RECORD_FILE;
+  memcpy (new->name, key->name, key->len);
+  written = inode_write_at (dir->inode, new, size, ofs + used)
+            == (off_t) size;
+  free (new);
+  if (!written)
+    return false;
+
+  if (used > 0)
+    {
+      old.reclen = used;
+      if (inode_write_at (dir->inode, &old.reclen, sizeof old.reclen,
+                          ofs + offsetof (struct dir_record, reclen))
+          != sizeof old.reclen)
+        return false;
+    }
+  return true;
+}
+
+/* Removes the record at byte offset OFS of DIR by merging it into the
+   record before it in its block, or by marking it free if it is the
+   first one. Returns false if writing fails. */
+static bool
+record_remove (struct dir *dir, off_t ofs)
+{
+  off_t block_start = ofs - ofs % BLOCK_SECTOR_SIZE;
+  const struct dir_block *b = inode_get_sector (dir->inode, block_start);
+  size_t rec_ofs = 0;
+  off_t prev_ofs = -1;
+  uint16_t reclen = 0;
+
+  if (b == NULL)
+    return false;
+  while (block_start + (off_t) rec_ofs < ofs)
+    {
+      const struct dir_record *r =
+        (const struct dir_record *) (b->records + rec_ofs);
+      ASSERT (r->reclen > 0);
+      prev_ofs = block_start + rec_ofs;
+      reclen = r->reclen;
+      rec_ofs += r->reclen;
+    }
+  ASSERT (block_start + (off_t) rec_ofs == ofs);
+  reclen += ((const struct dir_record *) (b->records + rec_ofs))->reclen;
+  filesys_cache_put (b, false);
+
+  if (prev_ofs < 0)
+    {
+      uint8_t type = DIR_RECORD_FREE;
+      return inode_write_at (dir->inode, &type, sizeof type,
+                             ofs + offsetof (struct dir_record, type))
+               == sizeof type;
+    }
+  return inode_write_at (dir->inode, &reclen, sizeof reclen,
+                         prev_ofs + offsetof (struct dir_record, reclen))
+           == sizeof reclen;
+}
+
+
+/* Returns the bucket of the hashed directory with HEADER which holds the
+   entries whose names have HASH. */
+static uint32_t
+bucket_of (const struct dir_header *header, unsigned hash)
+{
+  uint32_t bucket = hash % header->round_cnt;
+
+  /* buckets split in the current round distribute over twice as many */
+  if (bucket < header->bucket_cnt - header->round_cnt)
+    bucket = hash % (2 * header->round_cnt);
+  return bucket;
+}
+
+/* Searches the bucket of DIR in the hashed format starting at BLOCK for the
+   first record selected by MATCH and KEY like dir_scan().
+   If LASTP is non-null, sets it to the last block of the bucket if no
+   record was found. */
+static bool
+bucket_scan (const struct dir *dir, uint32_t block, enum dir_scan_match match,
+             const struct dir_key *key, struct dir_entry *ep, off_t *ofsp,
+             uint32_t *lastp)
+{
+  while (block != 0)
+    {
+      off_t block_start = (off_t) block * BLOCK_SECTOR_SIZE;
+      uint32_t next;
 
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (e.in_use && !strcmp (name, e.name)) 
-      {
-        if (ep != NULL)
-          *ep = e;
-        if (ofsp != NULL)
-          *ofsp = ofs;
+      if (block_scan (dir, block_start, block_start, match, key, ep, ofsp,
+                      &next))
         return true;
-      }
+      if (lastp != NULL)
+        *lastp = block;
+      block = next;
+    }
   return false;
 }
 
+/* Like lookup() for DIR in the hashed format, only the bucket of the name
+   is searched. */
+static bool
+lookup_hashed (const struct dir *dir, const struct dir_key *key,
+               struct dir_entry *ep, off_t *ofsp)
+{
+  const struct dir_header *header = inode_get_sector (dir->inode, 0);
+  if (header == NULL)
+    return false;
+  uint32_t block = header->buckets[bucket_of (header, key->hash)];
+  filesys_cache_put (header, false);
+
+  return bucket_scan (dir, block, MATCH_NAME, key, ep, ofsp, NULL);
+}
+
+/* Appends an empty block to DIR in the hashed format with HEADER and
+   stores its number into *BLOCKP. Returns false if the disk is full. */
+static bool
+append_bucket_block (struct dir *dir, struct dir_header *header,
+                     uint32_t *blockp)
+{
+  uint32_t block = header->block_cnt;
+
+  if (!append_block (dir, (off_t) block * BLOCK_SECTOR_SIZE))
+    return false;
+  header->block_cnt++;
+  *blockp = block;
+  return true;
+}
+
+/* Writes a record for the entry with KEY referring to INODE_SECTOR, a
+   directory if IS_DIR is true, into BUCKET of DIR in the hashed format
+   with HEADER, chaining an overflow block to the bucket if no record has
+   room for it. Sets *OVERFLOWP to true in that case. Returns false if the
+   disk is full. */
+static bool
+bucket_insert (struct dir *dir, struct dir_header *header, uint32_t bucket,
+               const struct dir_key *key, block_sector_t inode_sector,
+               bool is_dir, bool *overflowp)
+{
+  uint32_t last = 0;
+  off_t ofs;
+
+  if (!bucket_scan (dir, header->buckets[bucket], MATCH_FREE, key, NULL,
+                    &ofs, &last))
+    {
+      uint32_t block;
+      if (!append_bucket_block (dir, header, &block)
+          || inode_write_at (dir->inode, &block, sizeof block,
+                             (off_t) last * BLOCK_SECTOR_SIZE
+                             + offsetof (struct dir_block, next))
+             != sizeof block)
+        return false;
+      *overflowp = true;
+      ofs = (off_t) block * BLOCK_SECTOR_SIZE;
+    }
+  return record_insert (dir, ofs, key, inode_sector, is_dir);
+}
+
+/* Splits the next bucket of DIR in the hashed format with HEADER, moving
+   the entries which hash to the new bucket into it. An entry is written
+   into the new bucket before it is removed from the old one, so that it is
+   not lost if the disk fills up meanwhile. The bucket is not split if
+   memory allocation fails. */
+static void
+split_bucket (struct dir *dir, struct dir_header *header)
+{
+  uint32_t old_bucket = header->bucket_cnt - header->round_cnt;
+  uint32_t new_bucket = header->bucket_cnt;
+  uint32_t block;
+  bool overflow;
+  struct dir_entry e;
+
+  if (header->bucket_cnt >= DIR_MAX_BUCKETS)
+    return;
+  e.name = malloc (NAME_MAX + 1);
+  if (e.name == NULL)
+    return;
+  if (!append_bucket_block (dir, header, &block))
+    {
+      free (e.name);
+      return;
+    }
+  header->buckets[new_bucket] = block;
+  header->bucket_cnt++;
+
+  for (block = header->buckets[old_bucket]; block != 0; )
+    {
+      off_t block_start = (off_t) block * BLOCK_SECTOR_SIZE;
+      off_t ofs = block_start;
+      struct dir_key key;
+      uint32_t next;
+
+      /* removing a record merges it into the one before, the offsets of
+         the following records stay valid */
+      while (block_scan (dir, block_start, ofs, MATCH_IN_USE, NULL, &e, &ofs,
+                         &next))
+        {
+          dir_key_init (&key, e.name);
+          if (bucket_of (header, key.hash) == new_bucket
+              && (!bucket_insert (dir, header, new_bucket, &key,
+                                  e.inode_sector, e.is_dir, &overflow)
+                  || !record_remove (dir, ofs)))
+            break;
+          ofs++;
+        }
+      block = next;
+    }
+
+  /* all buckets of the round are split */
+  if (header->bucket_cnt == 2 * header->round_cnt)
+    header->round_cnt *= 2;
+  free (e.name);
+}
+
+/* Adds the entry with KEY referring to INODE_SECTOR, a directory if IS_DIR
+   is true, to DIR in the hashed format, splitting a bucket if it
+   overflowed its bucket. Returns false if the disk is full or memory
+   allocation fails. */
+static bool
+add_hashed (struct dir *dir, const struct dir_key *key,
+            block_sector_t inode_sector, bool is_dir)
+{
+  struct dir_header *header = malloc (sizeof *header);
+  bool overflow = false;
+  bool success = false;
+
+  if (header == NULL)
+    return false;
+  if (inode_read_at (dir->inode, header, sizeof *header, 0) == sizeof *header)
+    {
+      uint32_t block_cnt = header->block_cnt;
+      success = bucket_insert (dir, header, bucket_of (header, key->hash),
+                               key, inode_sector, is_dir, &overflow);
+      if (success && overflow)
+        split_bucket (dir, header);
+
+      /* the header only changes when a block is appended */
+      if (header->block_cnt != block_cnt)
+        inode_write_at (dir->inode, header, sizeof *header, 0);
+    }
+  free (header);
+  return success;
+}
+
 /* Searches DIR for a file with the given NAME
    and returns true if one exists, false otherwise.
    On success, sets *INODE to an inode for the file, otherwise to
@@ -318,6 +1165,7 @@ dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode) 
 {
   struct dir_entry e;
+  struct dir_key key;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
@@ -338,14 +1186,80 @@ dir_lookup (const struct dir *dir, const char *name,
     }
   }
 
-  if (lookup (dir, name, &e, NULL))
-    *inode = inode_open (e.inode_sector);
+  block_sector_t parent = inode_get_inumber (dir->inode);
+  block_sector_t sector;
+  if (dentry_lookup (parent, name, &sector))
+    {
+      *inode = sector != 0 ? inode_open (sector) : NULL;
+      return *inode != NULL;
+    }
+
+  /* the directory is locked so that the result cached is not outdated by
+     a concurrent dir_add() or dir_remove(), and because entries of hashed
+     directories move while buckets are split */
+  dir_key_init (&key, name);
+  e.name = NULL;
+  lock_acquire (&dir->inode->inode_directory_lock);
+  if (key.len <= NAME_MAX && lookup (dir, &key, &e, NULL))
+    {
+      dentry_set (parent, name, e.inode_sector);
+      *inode = inode_open (e.inode_sector);
+    }
   else
-    *inode = NULL;
+    {
+      dentry_set (parent, name, 0);
+      *inode = NULL;
+    }
+  lock_release (&dir->inode->inode_directory_lock);
 
   return *inode != NULL;
 }
 
+/* Sets *OFSP to the offset of the first record of DIR in the linear
+   format with room for an entry with KEY, or of its end if there is none.
+   Records before the free entry hint of DIR are skipped, the hint is moved
+   to the first block with room for any entry. */
+static void
+find_slot (const struct dir *dir, const struct dir_key *key, off_t *ofsp)
+{
+  struct dir_key any = { NULL, 1, 0 };
+  off_t end = inode_reader_length (dir->inode);
+  off_t ofs;
+
+  if (!dir_scan (dir, dir->inode->dir_free_hint, MATCH_FREE, &any, NULL,
+                 &ofs))
+    {
+      dir->inode->dir_free_hint = end;
+      *ofsp = end;
+      return;
+    }
+  dir->inode->dir_free_hint = ofs - ofs % BLOCK_SECTOR_SIZE;
+  if (!dir_scan (dir, ofs, MATCH_FREE, key, NULL, ofsp))
+    *ofsp = end;
+}
+
+/* Returns true if DIR contains an entry with KEY. Otherwise, for a
+   directory in the linear format, sets *OFSP to the offset of a record with
+   room for it, or of the end of DIR if there is none, see find_slot().
+   The name is not searched for if it is cached as missing. Otherwise it
+   takes a scan of the whole directory in the linear format, only the
+   search for room starts at the free entry hint, so that it takes constant
+   time while entries are appended. DIR must be locked. */
+static bool
+find_name_or_slot (const struct dir *dir, const struct dir_key *key,
+                   off_t *ofsp)
+{
+  block_sector_t sector;
+  bool cached = dentry_lookup (inode_get_inumber (dir->inode), key->name,
+                               &sector);
+
+  if (cached ? sector != 0 : lookup (dir, key, NULL, NULL))
+    return true;
+  if (!dir->hashed)
+    find_slot (dir, key, ofsp);
+  return false;
+}
+
 /* Adds a file named NAME to DIR, which must not already contain a
    file by that name.  The file's inode is in sector
    INODE_SECTOR.
@@ -356,7 +1270,7 @@ bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector,
  bool directory)
 {
-  struct dir_entry e;
+  struct dir_key key;
   off_t ofs;
   bool success = false;
 
@@ -366,14 +1280,15 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector,
   /* Check NAME for validity. */
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
+  dir_key_init (&key, name);
 
   struct inode *directory_inode = dir_get_inode(dir);
   ASSERT (directory_inode != NULL);
 
   lock_acquire(&directory_inode->inode_directory_lock);
 
-  /* Check that NAME is not in use. */
-  if (lookup (dir, name, NULL, NULL))
+  /* Check that NAME is not in use and find room for it. */
+  if (find_name_or_slot (dir, &key, &ofs))
     goto done;
 
   /* if directory we add the directory to the file(in this 
@@ -385,36 +1300,20 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector,
     inode_close(child_inode);
   }
 
-  /* Set OFS to offset of free slot.
-     If there are no free slots, then it will be set to the
-     current end-of-file.
-     
-     inode_read_at() will only return a short read at end of file.
-     Otherwise, we'd need to verify that we didn't get a short
-     read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (!e.in_use)
-      break;
-
-  /* Write slot. */
-  e.in_use = true;
-  strlcpy (e.name, name, sizeof e.name);
-  e.inode_sector = inode_sector;
-  off_t bytes_written = inode_write_at (dir->inode, &e, sizeof e, ofs);
-
-  if((bytes_written) != (1*(sizeof e))){
-    lock_release(&directory_inode->inode_directory_lock);
-    return false;
-  }
-
-  /* check if write was successfully */
-  if (bytes_written == sizeof e)
-    success = true;
+  if (dir->hashed)
+    success = add_hashed (dir, &key, inode_sector, directory);
+  else
+    {
+      /* no record has room, start a new block */
+      if (ofs == inode_reader_length (dir->inode)
+          && !append_block (dir, ofs))
+        goto done;
+      success = record_insert (dir, ofs, &key, inode_sector, directory);
+    }
+  if (success)
+    dentry_set (inode_get_inumber (directory_inode), name, inode_sector);
 
  done:
-  /* Check that NAME is now in use. */
-  ASSERT (lookup (dir, name, NULL, NULL));
   lock_release(&directory_inode->inode_directory_lock);
   return success;
 }
@@ -427,6 +1326,7 @@ dir_remove (struct dir *dir, const char *name)
 {
   bool success = false;
   struct dir_entry e;
+  struct dir_key key;
   struct inode *inode = NULL;
   off_t ofs;
 
@@ -439,7 +1339,9 @@ dir_remove (struct dir *dir, const char *name)
   lock_acquire(&directory_inode->inode_directory_lock);
 
   /* Find directory entry. */
-  if (!lookup (dir, name, &e, &ofs))
+  dir_key_init (&key, name);
+  e.name = NULL;
+  if (key.len > NAME_MAX || !lookup (dir, &key, &e, &ofs))
   {
     goto done;
   }
@@ -469,16 +1371,20 @@ dir_remove (struct dir *dir, const char *name)
   }
 
 
-  /* Erase directory entry by writing new entry with in_use=false */
-  e.in_use = false;
-  if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
+  /* Erase directory entry by merging its record into the previous one */
+  if (!record_remove (dir, ofs))
   {
     goto done;
   }
 
 
+  /* the room is found by the next dir_add() */
+  if (ofs < directory_inode->dir_free_hint)
+    directory_inode->dir_free_hint = ofs - ofs % BLOCK_SECTOR_SIZE;
+
   /* Remove inode. */
   inode_remove (inode);
+  dentry_set (inode_get_inumber (directory_inode), name, 0);
   success = true;
 
  done:
@@ -494,40 +1400,75 @@ bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
   struct dir_entry e;
+  off_t ofs;
+  bool found;
+
+  /* the name is copied straight into NAME */
+  e.name = name;
+
+  /* blocks are scanned from their start, so that the position stays
+     valid if the record at it is merged into its predecessor. The
+     directory is locked because entries of hashed directories move while
+     buckets are split */
+  lock_acquire (&dir->inode->inode_directory_lock);
+  found = dir_scan (dir, dir->pos, MATCH_IN_USE, NULL, &e, &ofs);
+  lock_release (&dir->inode->inode_directory_lock);
+  if (found)
+    dir->pos = ofs + 1;
+  return found;
+}
+
+/* Reads the entries of DIR from its current position into BUFFER as
+   packed struct dirent records, as many as fit into SIZE bytes.
+   Returns the number of bytes written, 0 if the directory contains no
+   more entries, or -1 if the next entry does not fit into BUFFER.
+   The directory is locked while the records are read, like in
+   dir_readdir(). */
+int
+dir_getdents (struct dir *dir, void *buffer, size_t size)
+{
+  uint8_t *records = buffer;
+  size_t written = 0;
+  bool full = false;
+  struct dir_entry e;
+  off_t ofs;
 
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
+  /* one buffer for the names of all entries read */
+  e.name = malloc (NAME_MAX + 1);
+  if (e.name == NULL)
+    return -1;
+
+  lock_acquire (&dir->inode->inode_directory_lock);
+  while (dir_scan (dir, dir->pos, MATCH_IN_USE, NULL, &e, &ofs))
     {
-      dir->pos += sizeof e;
-      if (e.in_use)
+      size_t name_len = strlen (e.name);
+      size_t reclen = DIRENT_SIZE (name_len);
+      if (written + reclen > size)
         {
-          strlcpy (name, e.name, NAME_MAX + 1);
-          return true;
-        } 
+          full = true;
+          break;
+        }
+
+      struct dirent *d = (struct dirent *) (records + written);
+      d->inumber = e.inode_sector;
+      d->reclen = reclen;
+      d->is_dir = e.is_dir;
+      memcpy (d->name, e.name, name_len + 1);
+
+      written += reclen;
+      dir->pos = ofs + 1;
     }
-  return false;
+  lock_release (&dir->inode->inode_directory_lock);
+  free (e.name);
+
+  return written == 0 && full ? -1 : (int) written;
 }
 
 /* Checks if directory is empty */
 bool
 dir_is_empty (struct dir *dir)
 {
-  struct inode *inode = dir->inode;
-  struct dir_entry e;
-  off_t iterator_next_dir_entry = 0 * sizeof(e);
-
-  while (true) 
-    {
-      /* stop if no more valid entry was read! */
-      if (inode_read_at (inode, &e, sizeof e, iterator_next_dir_entry) != sizeof e)
-        break;
-
-      if (e.in_use)
-        {
-          return false;
-        } 
-      iterator_next_dir_entry += sizeof(e);
-    }
-  return true;
+  return !dir_scan (dir, 0, MATCH_IN_USE, NULL, NULL, NULL);
 }
 
 /* returns parent dir for passed directory */
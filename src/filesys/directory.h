@@ -1,20 +1,22 @@
 #ifndef FILESYS_DIRECTORY_H
 #define FILESYS_DIRECTORY_H
 
+#include <dirent.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include "devices/block.h"
 
-/* Maximum length of a file name component.
-   This is the traditional UNIX maximum length.
-   After directories are implemented, this maximum length may be
-   retained, but much longer full path names must be allowed. */
-#define NAME_MAX 14
-
 struct inode;
 
+/* create new directories in the hashed format */
+extern bool dir_use_hashed;
+
+void dir_init (void);
+
 /* Opening and closing directories. */
-struct dir *dir_create_root (block_sector_t sector, size_t entry_cnt);
+bool dir_create (block_sector_t sector);
+struct dir *dir_create_root (block_sector_t sector);
+bool dir_convert_slots (void);
 struct dir *dir_open (struct inode *);
 struct dir *dir_open_root (void);
 struct dir *dir_reopen (struct dir *);
@@ -26,6 +28,7 @@ bool dir_lookup (const struct dir *, const char *name, struct inode **);
 bool dir_add (struct dir *, const char *name, block_sector_t, bool);
 bool dir_remove (struct dir *, const char *name);
 bool dir_readdir (struct dir *, char name[NAME_MAX + 1]);
+int dir_getdents (struct dir *, void *buffer, size_t size);
 struct dir* dir_open_path(const char *);
 bool dir_is_empty (struct dir *dir);
 
@@ -9,6 +9,7 @@ struct file
     struct inode *inode;        /* File's inode. */
     off_t pos;                  /* Current position. */
     bool deny_write;            /* Has file_deny_write() been called? */
+    struct inode_read_ahead read_ahead; /* Sequential read-ahead state. */
   };
 
 /* Opens a file for the given INODE, of which it takes ownership,
@@ -23,6 +24,7 @@ file_open (struct inode *inode)
       file->inode = inode;
       file->pos = 0;
       file->deny_write = false;
+      inode_read_ahead_init (&file->read_ahead);
       return file;
     }
   else
@@ -68,7 +70,8 @@ file_get_inode (struct file *file)
 off_t
 file_read (struct file *file, void *buffer, off_t size) 
 {
-  off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+  off_t bytes_read = inode_read_stream_at (file->inode, buffer, size,
+                                          file->pos, &file->read_ahead);
   file->pos += bytes_read;
   return bytes_read;
 }
@@ -81,7 +84,8 @@ file_read (struct file *file, void *buffer, off_t size)
 off_t
 file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs) 
 {
-  return inode_read_at (file->inode, buffer, size, file_ofs);
+  return inode_read_stream_at (file->inode, buffer, size, file_ofs,
+                               &file->read_ahead);
 }
 
 /* Writes SIZE bytes from BUFFER into FILE,
@@ -26,6 +26,8 @@ filesys_init (bool format)
 
   inode_init ();
 
+  dir_init ();
+
   free_map_init ();
 
   filesys_cache_init();
@@ -35,6 +37,16 @@ filesys_init (bool format)
   }
 
   free_map_open ();
+
+  /* directories of earlier versions hold fixed-size entries, which are
+     converted to records once */
+  struct inode *root = inode_open (ROOT_DIR_SECTOR);
+  if (root == NULL)
+    PANIC ("can't open the root directory");
+  bool old_format = inode_has_old_dir_format (root);
+  inode_close (root);
+  if (old_format && !dir_convert_slots ())
+    PANIC ("converting the directories of the file system failed");
 }
 
 /* Shuts down the file system module, writing any unwritten data
@@ -85,13 +97,26 @@ filesys_create (const char *name, off_t initial_size, bool directory)
 
   /* check if directory is valid and create new inode with flag directory
   which indicates if inode is used as directory */
-  bool success = (dir != NULL
+  bool created = (dir != NULL
                   && free_map_allocate (1, &inode_sector)
-                  && inode_create (inode_sector, initial_size, directory)
-                  && dir_add (dir, file_name, inode_sector, directory));
-
-  /* if dir_add or inode_create failed release sector again */
-  if (!success && inode_sector != 0) 
+                  && (directory ? dir_create (inode_sector)
+                      : inode_create (inode_sector, initial_size, false)));
+  bool success = created
+                 && dir_add (dir, file_name, inode_sector, directory);
+
+  /* if dir_add failed remove the new inode together with its blocks, it
+     might be kept open in memory already. If inode_create failed release
+     the sector again */
+  if (!success && created)
+    {
+      struct inode *inode = inode_open (inode_sector);
+      if (inode != NULL)
+        inode_remove (inode);
+      else
+        free_map_release (inode_sector, 1);
+      inode_close (inode);
+    }
+  else if (!success && inode_sector != 0)
     free_map_release (inode_sector, 1);
 
   dir_close (dir);
@@ -225,7 +250,7 @@ do_format (void)
 {
   printf ("Formatting file system...");
   free_map_create ();
-  struct dir *root_dir = dir_create_root (ROOT_DIR_SECTOR, 16);
+  struct dir *root_dir = dir_create_root (ROOT_DIR_SECTOR);
   if (root_dir == NULL)
     PANIC ("root directory creation failed");
   inode_writeback(dir_get_inode(root_dir));
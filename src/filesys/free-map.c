@@ -1,12 +1,31 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <limits.h>
+#include <round.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "threads/synch.h"
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
+static struct lock free_map_lock;    /* Protects the free map. */
+
+/* Sectors of the free map file whose bits changed since they were
+   last written, one bit per sector of the file.  Only these are
+   written when the free map is committed. */
+static struct bitmap *changed_map_sectors;
+
+/* Number of open batches, the free map is committed when the last
+   one ends. */
+static int batch_cnt;
+
+/* Sector after the last run allocated without a hint. */
+static block_sector_t rover;
+
+static void mark_changed (block_sector_t sector, size_t cnt);
+static void commit (void);
 
 /* Initializes the free map. */
 void
@@ -15,6 +34,14 @@ free_map_init (void)
   free_map = bitmap_create (block_size (fs_device));
   if (free_map == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
+  changed_map_sectors =
+    bitmap_create (DIV_ROUND_UP (bitmap_file_size (free_map),
+                                 BLOCK_SECTOR_SIZE));
+  if (changed_map_sectors == NULL)
+    PANIC ("bitmap creation failed--file system device is too large");
+  lock_init (&free_map_lock);
+  batch_cnt = 0;
+  rover = 0;
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
 }
@@ -22,31 +49,138 @@ free_map_init (void)
 /* Allocates CNT consecutive sectors from the free map and stores
    the first into *SECTORP.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available.  The change is written to the free map
+   file at the end of the current batch, or right away if there is
+   none. */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
+  lock_acquire (&free_map_lock);
   block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  if (sector != BITMAP_ERROR)
     {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
+      mark_changed (sector, cnt);
+      if (batch_cnt == 0)
+        commit ();
+      *sectorp = sector;
     }
-  if (sector != BITMAP_ERROR)
-    *sectorp = sector;
+  lock_release (&free_map_lock);
   return sector != BITMAP_ERROR;
 }
 
+/* Allocates a run of up to CNT consecutive sectors, at least one,
+   and stores the first into *SECTORP.  The run starts at the first
+   free sector at or after HINT, wrapping around to the start of the
+   disk, and extends as far as the following sectors are free.  A
+   HINT of 0 continues after the previous run allocated without a
+   hint.  Returns the number of sectors allocated, 0 if the disk is
+   full.  Commits like free_map_allocate(). */
+size_t
+free_map_allocate_run (size_t cnt, block_sector_t hint,
+                       block_sector_t *sectorp)
+{
+  size_t size = bitmap_size (free_map);
+  block_sector_t start = hint != 0 ? hint : rover;
+  block_sector_t sector;
+  size_t run_cnt = 1;
+
+  ASSERT (cnt > 0);
+
+  lock_acquire (&free_map_lock);
+  if (start >= size)
+    start = 0;
+  sector = bitmap_scan (free_map, start, 1, false);
+  if (sector == BITMAP_ERROR)
+    sector = bitmap_scan (free_map, 0, 1, false);
+  if (sector == BITMAP_ERROR)
+    {
+      lock_release (&free_map_lock);
+      return 0;
+    }
+
+  while (run_cnt < cnt && sector + run_cnt < size
+         && !bitmap_test (free_map, sector + run_cnt))
+    run_cnt++;
+  bitmap_set_multiple (free_map, sector, run_cnt, true);
+  mark_changed (sector, run_cnt);
+  if (batch_cnt == 0)
+    commit ();
+  if (hint == 0)
+    rover = sector + run_cnt;
+  lock_release (&free_map_lock);
+
+  *sectorp = sector;
+  return run_cnt;
+}
+
 /* Makes CNT sectors starting at SECTOR available for use. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
   bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  mark_changed (sector, cnt);
+  if (batch_cnt == 0)
+    commit ();
+  lock_release (&free_map_lock);
+}
+
+/* Starts a batch of allocations and releases, which are written to
+   the free map file together once every batch has ended.  Batches
+   may nest. */
+void
+free_map_begin_batch (void)
+{
+  lock_acquire (&free_map_lock);
+  batch_cnt++;
+  lock_release (&free_map_lock);
+}
+
+/* Ends a batch started with free_map_begin_batch(). */
+void
+free_map_end_batch (void)
+{
+  lock_acquire (&free_map_lock);
+  ASSERT (batch_cnt > 0);
+  if (--batch_cnt == 0)
+    commit ();
+  lock_release (&free_map_lock);
+}
+
+/* Records that the bits of the CNT sectors starting at SECTOR
+   changed.  Bit N of the free map is stored in byte N / CHAR_BIT of
+   the free map file. */
+static void
+mark_changed (block_sector_t sector, size_t cnt)
+{
+  size_t first = sector / CHAR_BIT / BLOCK_SECTOR_SIZE;
+  size_t last = (sector + cnt - 1) / CHAR_BIT / BLOCK_SECTOR_SIZE;
+
+  bitmap_set_multiple (changed_map_sectors, first, last - first + 1, true);
+}
+
+/* Writes the changed sectors of the free map file through the
+   buffer cache.  Changes made before the free map file is open are
+   written by free_map_create().  The free map must be locked. */
+static void
+commit (void)
+{
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&free_map_lock));
+  if (free_map_file == NULL)
+    return;
+
+  for (i = bitmap_scan (changed_map_sectors, 0, 1, true);
+       i != BITMAP_ERROR;
+       i = bitmap_scan (changed_map_sectors, i + 1, 1, true))
+    {
+      if (!bitmap_write_range (free_map, free_map_file,
+                               i * BLOCK_SECTOR_SIZE, BLOCK_SECTOR_SIZE))
+        PANIC ("can't write free map");
+      bitmap_reset (changed_map_sectors, i);
+    }
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -58,13 +192,18 @@ free_map_open (void)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  bitmap_set_all (changed_map_sectors, false);
 }
 
 /* Writes the free map to disk and closes the free map file. */
 void
 free_map_close (void) 
 {
+  lock_acquire (&free_map_lock);
+  commit ();
+  lock_release (&free_map_lock);
   file_close (free_map_file);
+  free_map_file = NULL;
 }
 
 /* Creates a new free map file on disk and writes the free map to
@@ -82,4 +221,5 @@ free_map_create (void)
     PANIC ("can't open free map");
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
+  bitmap_set_all (changed_map_sectors, false);
 }
@@ -12,6 +12,10 @@ void free_map_open (void);
 void free_map_close (void);
 
 bool free_map_allocate (size_t, block_sector_t *);
+size_t free_map_allocate_run (size_t cnt, block_sector_t hint,
+                              block_sector_t *);
 void free_map_release (block_sector_t, size_t);
+void free_map_begin_batch (void);
+void free_map_end_batch (void);
 
 #endif /* filesys/free-map.h */
@@ -12,484 +12,645 @@
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
+/* Identifies an inode in the extent format. */
+#define INODE_EXTENT_MAGIC 0x494e4f45
 #define PARENT_MAGIC 2000000000
 
+/* formats of a directory noted in inode_disk.directory, 0 marks a file */
+/* fixed-size entries, written by earlier versions and no longer read */
+#define INODE_DIR_SLOTS 1
+/* variable-length records, linear */
+#define INODE_DIR_RECORDS 2
+/* variable-length records in buckets behind a header, see directory.c */
+#define INODE_DIR_HASHED 3
 
+/* maximal number of blocks queued for read-ahead in front of a sequential
+   reader */
+#define READ_AHEAD_MAX_WINDOW 32
+
+/* maximal number of closed inodes kept in memory for reopening */
+#define CLOSED_INODES_MAX 32
+
+
+static block_sector_t byte_to_sector (struct inode *inode, off_t pos);
 static block_sector_t byte_to_sector_indirect (
-        const struct inode *inode, off_t pos);
+        struct inode *inode, off_t pos);
 static block_sector_t byte_to_sector_double_indirect (
-        const struct inode *inode, off_t pos);
+        struct inode *inode, off_t pos);
+static block_sector_t block_map_lookup (struct inode *inode, int leaf,
+                                        off_t index);
+static void block_map_invalidate (struct inode *inode);
 
 size_t number_of_sectors (off_t size);
 
-bool inode_allocate_indirect_sectors(block_sector_t *sectors,
-       size_t sectors_to_write, size_t index_offset);
+/* Hands out the sectors needed to grow an inode one by one, taking them
+   from runs of contiguous free sectors so that the inode is laid out
+   contiguously on disk. */
+struct inode_allocator
+  {
+    block_sector_t next;                /* next sector of the current run */
+    size_t run_left;                    /* sectors left in the current run */
+    size_t wanted;                      /* sectors expected to be needed */
+  };
+
+static void allocator_init (struct inode_allocator *, size_t data_sectors,
+                            block_sector_t hint);
+static bool allocator_next (struct inode_allocator *,
+                            block_sector_t *sectorp);
+static block_sector_t allocator_finish (struct inode_allocator *);
+
+static block_sector_t inode_fill_hole (struct inode *inode, off_t pos,
+                                       struct inode_allocator *allocator);
+static bool inode_fill_holes (block_sector_t sector);
+static bool fill_pointer (struct inode *inode, block_sector_t *pointer,
+                          struct inode_allocator *allocator);
+static bool fill_indirect_pointer (struct inode *inode,
+       block_sector_t indirect_sector, size_t index, block_sector_t *sectorp,
+       struct inode_allocator *allocator);
+
+void inode_deallocate_indirect_sectors(block_sector_t sector);
+
+void inode_deallocate_double_indirect_sectors(block_sector_t sector);
+
+bool inode_grow(struct inode *inode, struct inode_disk *inode_disk,
+       off_t size, off_t offset);
 
-bool inode_allocate_double_indirect_sectors(block_sector_t *sectors,
-       size_t num_of_sectors, size_t start_index_indirect,
-       size_t start_index_double_indirect);
+static bool inode_grow_extents (struct inode *inode,
+       struct inode_disk *inode_disk, off_t size, off_t offset);
+static void inode_deallocate_extents (struct inode_extents *extents);
+static block_sector_t byte_to_sector_extents (const struct inode *inode,
+                                              off_t pos);
+static void extent_read (const struct inode_extents *extents, uint32_t i,
+                         struct inode_extent *extent);
+static void extent_write (struct inode_extents *extents, uint32_t i,
+                          const struct inode_extent *extent);
+static bool extent_append (struct inode_extents *extents,
+                           block_sector_t sector,
+                           struct inode_allocator *allocator);
+static void extent_truncate (struct inode_extents *extents, uint32_t cnt,
+                             const struct inode_extent *last,
+                             block_sector_t index);
+static size_t extent_leaf_cnt (uint32_t cnt);
+
+bool inode_use_extents;
+
+/* Open inodes hashed by sector, so that opening a single inode twice
+   returns the same `struct inode'. */
+static struct hash open_inodes;
 
-void inode_deallocate_indirect_sectors(block_sector_t *sectors,
-       size_t num_of_sectors);
+/* Protects open_inodes and the open_cnt and busy members of the inodes in
+   it. */
+static struct lock open_inodes_lock;
 
-void inode_deallocate_double_indirect_sectors(block_sector_t *sectors,
-       size_t num_of_sectors);
+/* Signaled when an inode stops being busy. */
+static struct condition open_inodes_cond;
 
-bool inode_grow(struct inode *inode, struct inode_disk *inode_disk,
-       off_t size, off_t offset);
+/* Inodes in open_inodes which are not open anymore but were kept for being
+   reopened, least recently closed first. They are written back already and
+   freed when the list grows beyond CLOSED_INODES_MAX or memory runs out.
+   Protected by open_inodes_lock. */
+static struct list closed_inodes;
 
-off_t inode_reader_length (struct inode *inode);
+static void inode_store (struct inode *inode);
+static bool reclaim_closed_inode (void);
+static void forget_closed_inode (block_sector_t sector);
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+static unsigned open_inodes_hash (const struct hash_elem *, void *aux);
+static bool open_inodes_less (const struct hash_elem *,
+                              const struct hash_elem *, void *aux);
+static struct inode *open_inodes_find (block_sector_t sector);
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  if (!hash_init (&open_inodes, open_inodes_hash, open_inodes_less, NULL))
+    PANIC ("can't create open inode table");
+  lock_init (&open_inodes_lock);
+  cond_init (&open_inodes_cond);
+  list_init (&closed_inodes);
 }
 
-/* allocates inode corresponding to passed inode_disk. Recoursively
-   created indirect + doubly indirect structure */
-bool
-inode_allocate (struct inode_disk *inode_disk)
+/* hash function of open_inodes, inodes are hashed by their sector */
+static unsigned
+open_inodes_hash (const struct hash_elem *e, void *aux UNUSED)
 {
-  if (inode_disk->length > MAX_FILESIZE)
-    return false;
-
-  size_t num_of_sectors = number_of_sectors(inode_disk->length);
+  return hash_int (hash_entry (e, struct inode, elem)->sector);
+}
 
-  uint8_t zero_sector[BLOCK_SECTOR_SIZE]; 
-  int zero_iterator = 0;
-  for (zero_iterator = 0; zero_iterator < BLOCK_SECTOR_SIZE; zero_iterator++){
-    zero_sector[zero_iterator] = 0;
-  }
+/* orders the inodes in open_inodes by sector */
+static bool
+open_inodes_less (const struct hash_elem *a, const struct hash_elem *b,
+                  void *aux UNUSED)
+{
+  return hash_entry (a, struct inode, elem)->sector
+         < hash_entry (b, struct inode, elem)->sector;
+}
 
-  unsigned index_level = 0;
-  off_t current_index = 0;
-  off_t indirect_index = 0;
-  off_t double_indirect_index = 0;
+/* returns the open inode of sector or NULL if it is not open. open_inodes_lock
+   must be held */
+static struct inode *
+open_inodes_find (block_sector_t sector)
+{
+  struct inode key;
+  struct hash_elem *e;
 
-  bool success = true;
+  ASSERT (lock_held_by_current_thread (&open_inodes_lock));
+  key.sector = sector;
+  e = hash_find (&open_inodes, &key.elem);
+  return e != NULL ? hash_entry (e, struct inode, elem) : NULL;
+}
 
-  while (num_of_sectors > 0 && current_index < NUMBER_DIRECT_BLOCKS) {
-    success &= free_map_allocate (1,
-                        &inode_disk->direct_pointers[current_index]);
-    filesys_cache_write(inode_disk->direct_pointers[current_index],
-                        zero_sector, 0, BLOCK_SECTOR_SIZE);
-    num_of_sectors -= 1;
-    current_index += 1;
-  }
+/* prepares allocator to hand out the sectors for data_sectors more data
+   blocks plus the indirect blocks referring to them, starting at the first
+   free sector at or after hint (0 for no hint) */
+static void
+allocator_init (struct inode_allocator *allocator, size_t data_sectors,
+                block_sector_t hint)
+{
+  allocator->next = hint;
+  allocator->run_left = 0;
+  allocator->wanted = data_sectors
+                      + DIV_ROUND_UP (data_sectors, NUMBER_INDIRECT_POINTERS)
+                      + 2;
+}
 
-  /* still stuff to write after direct blocks filled */
-  if (current_index == NUMBER_DIRECT_BLOCKS){
-    current_index = 0;
-    index_level = 1;
-  }
 
-  while (num_of_sectors > 0 && current_index < NUMBER_INDIRECT_BLOCKS) {
-    size_t sectors_to_write = 0;
-    if (num_of_sectors > NUMBER_INDIRECT_POINTERS){
-      sectors_to_write = NUMBER_INDIRECT_POINTERS;
-    } else {
-      sectors_to_write = num_of_sectors;
+/* stores the next sector for the growing inode into sectorp, allocating a
+   new run of free sectors behind the previous one when the current run is
+   used up. Returns false if the disk is full */
+static bool
+allocator_next (struct inode_allocator *allocator, block_sector_t *sectorp)
+{
+  if (allocator->run_left == 0)
+    {
+      if (allocator->wanted == 0)
+        allocator->wanted = 1;
+      allocator->run_left = free_map_allocate_run (allocator->wanted,
+                                                   allocator->next,
+                                                   &allocator->next);
+      if (allocator->run_left == 0)
+        return false;
     }
 
-    success &= inode_allocate_indirect_sectors(
-                   &inode_disk->indirect_pointers[current_index],
-                   sectors_to_write, 0);
-    /* + 0 because the offset we start to allocate new sectors is always 0 
-       during allocation of inodes */
-    indirect_index = sectors_to_write + 0;
-    num_of_sectors -= sectors_to_write;
-
-    if (indirect_index == NUMBER_INDIRECT_POINTERS){
-      current_index += 1;
-      indirect_index = 0;
-    } else {
-      ASSERT(num_of_sectors == 0);
-    }
-  }
+  *sectorp = allocator->next;
+  allocator->next += 1;
+  allocator->run_left -= 1;
+  if (allocator->wanted > 0)
+    allocator->wanted -= 1;
+  return true;
+}
 
-  /* still stuff to write after indirect blocks filled */
-  if (current_index == NUMBER_INDIRECT_BLOCKS){
-    current_index = 0;
-    indirect_index = 0;
-    double_indirect_index = 0;
-    index_level = 2;
-  }
 
-  if (num_of_sectors > 0) {
-    success &= inode_allocate_double_indirect_sectors(
-                   &inode_disk->double_indirect_pointers[current_index],
-                   num_of_sectors, 0 , 0);
+/* releases the sectors of the current run which were not needed. Returns
+   the sector after the last one handed out, where the next growth of the
+   inode should continue */
+static block_sector_t
+allocator_finish (struct inode_allocator *allocator)
+{
+  if (allocator->run_left > 0)
+    free_map_release (allocator->next, allocator->run_left);
+  allocator->run_left = 0;
+  return allocator->next;
+}
 
-    indirect_index = num_of_sectors / NUMBER_INDIRECT_POINTERS;
-    double_indirect_index = num_of_sectors % NUMBER_INDIRECT_POINTERS;
+
+/* grow the inode such that a write at offset of size size could be performed
+   successfully. In the pointer format the new part of the file consists of
+   holes, sector 0 in the block map, which are only allocated when they are
+   written first */
+bool
+inode_grow(struct inode *inode, struct inode_disk *inode_disk, off_t size,
+           off_t offset)
+{
+  if (inode != NULL){
+    ASSERT(lock_held_by_current_thread(&inode->inode_extend_lock));
+    inode->dirty = true;
   }
 
-  inode_disk->current_index = current_index;
-  inode_disk->indirect_index = indirect_index;
-  inode_disk->double_indirect_index = double_indirect_index;
-  inode_disk->index_level = index_level;
+  if (inode != NULL ? inode->extent_format
+                    : inode_disk->magic == INODE_EXTENT_MAGIC)
+    return inode_grow_extents(inode, inode_disk, size, offset);
 
-  return success;
+  return size + offset <= MAX_FILESIZE;
 }
 
 
-/* allocate sectors_to_write number of sectors in the indirect sector structure 
-   in this sector starting at index index_offset */
-bool
-inode_allocate_indirect_sectors(block_sector_t *sectors,
-                                size_t sectors_to_write, size_t index_offset)
+/* allocates the data block holding byte offset pos of the inode if it is a
+   hole, together with the indirect blocks leading to it which are holes as
+   well. The blocks are taken from allocator, so that the holes filled by a
+   single write are laid out contiguously. New blocks are zeroed in the
+   cache without reading them. Returns the sector of the data block or 0 if
+   the disk is full */
+static block_sector_t
+inode_fill_hole (struct inode *inode, off_t pos,
+                 struct inode_allocator *allocator)
 {
-  ASSERT(sectors_to_write > 0);
-  ASSERT(sectors_to_write + index_offset <= NUMBER_INDIRECT_POINTERS);
+  bool extend_lock_held = lock_held_by_current_thread(&inode->inode_extend_lock);
+  if (!extend_lock_held)
+    lock_acquire(&inode->inode_extend_lock);
 
-  bool success = true;
-  size_t indirect_iterator = 0;
-  struct indirect_block indirect_block;
+  /* somebody else might have filled the hole meanwhile */
+  block_sector_t sector = byte_to_sector(inode, pos);
+  if (sector == 0) {
+    off_t block = pos / BLOCK_SECTOR_SIZE;
+    bool success;
+
+    if (pos < DIRECT_BLOCKS_END) {
+      success = fill_pointer(inode, &inode->direct_pointers[block],
+                             allocator);
+      sector = inode->direct_pointers[block];
+    } else if (pos < INDIRECT_BLOCKS_END) {
+      block -= NUMBER_DIRECT_BLOCKS;
+      block_sector_t *indirect_pointer =
+        &inode->indirect_pointers[block / NUMBER_INDIRECT_POINTERS];
+      success = fill_pointer(inode, indirect_pointer, allocator)
+                && fill_indirect_pointer(inode, *indirect_pointer,
+                                         block % NUMBER_INDIRECT_POINTERS,
+                                         &sector, allocator);
+    } else {
+      block -= NUMBER_DIRECT_BLOCKS
+               + NUMBER_INDIRECT_BLOCKS * NUMBER_INDIRECT_POINTERS;
+      block_sector_t indirect_sector;
+      success = fill_pointer(inode, &inode->double_indirect_pointers[0],
+                             allocator)
+                && fill_indirect_pointer(inode,
+                                         inode->double_indirect_pointers[0],
+                                         block / NUMBER_INDIRECT_POINTERS,
+                                         &indirect_sector, allocator)
+                && fill_indirect_pointer(inode, indirect_sector,
+                                         block % NUMBER_INDIRECT_POINTERS,
+                                         &sector, allocator);
+    }
 
-  uint8_t zero_sector[BLOCK_SECTOR_SIZE]; 
-  int zero_iterator = 0;
-  for (zero_iterator = 0; zero_iterator < BLOCK_SECTOR_SIZE; zero_iterator++){
-    zero_sector[zero_iterator] = 0;
+    /* the copied block map might still show the hole, the pointers of the
+       inode itself may have been filled */
+    block_map_invalidate(inode);
+    inode->dirty = true;
+    if (!success)
+      sector = 0;
   }
 
-  if (index_offset == 0){
-    success &= free_map_allocate (1, sectors);
-  } else {
-    filesys_cache_read(*sectors, &indirect_block, 0, BLOCK_SECTOR_SIZE);
-  }
+  if (!extend_lock_held)
+    lock_release(&inode->inode_extend_lock);
+  return sector;
+}
 
-  for (indirect_iterator = 0; indirect_iterator < sectors_to_write;
-                                                  indirect_iterator++) {
-    success &= free_map_allocate (1,
-              &indirect_block.block_pointers[indirect_iterator + index_offset]);
-    filesys_cache_write(indirect_block.block_pointers[indirect_iterator
-                          + index_offset], zero_sector, 0, BLOCK_SECTOR_SIZE);
-  }
 
-  filesys_cache_write(*sectors, &indirect_block, 0, BLOCK_SECTOR_SIZE);
+/* allocates a zeroed block from allocator into *pointer, unless it points
+   to a block already */
+static bool
+fill_pointer (struct inode *inode, block_sector_t *pointer,
+              struct inode_allocator *allocator)
+{
+  if (*pointer != 0)
+    return true;
+
+  block_sector_t sector;
+  if (!allocator_next(allocator, &sector))
+    return false;
+  filesys_cache_zero(sector);
+  inode->alloc_hint = sector + 1;
+  *pointer = sector;
+  return true;
+}
 
+
+/* fills the pointer at index of the indirect block in indirect_sector like
+   fill_pointer and stores the block it points to into *sectorp */
+static bool
+fill_indirect_pointer (struct inode *inode, block_sector_t indirect_sector,
+                       size_t index, block_sector_t *sectorp,
+                       struct inode_allocator *allocator)
+{
+  struct indirect_block *indirect_block =
+    filesys_cache_get(indirect_sector, true);
+  block_sector_t pointer = indirect_block->block_pointers[index];
+  bool success = fill_pointer(inode, &pointer, allocator);
+  indirect_block->block_pointers[index] = pointer;
+  filesys_cache_put(indirect_block, success);
+  *sectorp = pointer;
   return success;
 }
 
 
-/* allocate sectors_to_write number of sectors in the doubly indirect sector 
-   structure in this sector starting at index start_index_offset for the first
-   indirection and the index start_index_double_indirect for the second 
-   indirection.
-   Our system only supports ONE double_indirect_sector */
-bool
-inode_allocate_double_indirect_sectors(block_sector_t *sectors,
-            size_t num_of_sectors, size_t start_index_indirect,
-            size_t  start_index_double_indirect)
+void
+inode_deallocate (struct inode *inode)
 {
-  ASSERT(num_of_sectors > 0);
+  if (inode->extent_format) {
+    inode_deallocate_extents(&inode->extents);
+    return;
+  }
 
-  bool success = true;
+  block_map_invalidate(inode);
 
-  size_t indirect_iterator = start_index_indirect;
-  size_t double_indirect_iterator = start_index_double_indirect;
-  struct indirect_block double_indirect_block;
+  /* holes are skipped, blocks past the end of file are holes as well */
+  int iter = 0;
+  for (iter = 0; iter < NUMBER_DIRECT_BLOCKS; iter++)
+    if (inode->direct_pointers[iter] != 0)
+      free_map_release (inode->direct_pointers[iter], 1);
 
-  if (start_index_indirect == 0 && start_index_double_indirect == 0){
-    success &= free_map_allocate (1, sectors);
-  } else {
-    filesys_cache_read(*sectors, &double_indirect_block, 0, BLOCK_SECTOR_SIZE);
-  }
+  for (iter = 0; iter < NUMBER_INDIRECT_BLOCKS; iter++)
+    inode_deallocate_indirect_sectors(inode->indirect_pointers[iter]);
 
-  while ((unsigned)number_of_sectors > 0) {
-    size_t sectors_to_write = 0;
-    if (num_of_sectors + double_indirect_iterator > NUMBER_INDIRECT_POINTERS)
-      sectors_to_write = NUMBER_INDIRECT_POINTERS - double_indirect_iterator;
-    else
-      sectors_to_write = num_of_sectors;
+  for (iter = 0; iter < NUMBER_DOUBLE_INDIRECT_BLOCKS; iter++)
+    inode_deallocate_double_indirect_sectors(
+                  inode->double_indirect_pointers[iter]);
+}
 
-    inode_allocate_indirect_sectors(
-             &double_indirect_block.block_pointers[indirect_iterator],
-             sectors_to_write, double_indirect_iterator); 
 
-    num_of_sectors -= sectors_to_write;
-    indirect_iterator += 1;
-    double_indirect_iterator = 0;
+/* deallocate the blocks the indirect block in sector points to and the
+   indirect block itself, unless it is a hole */
+void
+inode_deallocate_indirect_sectors(block_sector_t sector)
+{
+  if (sector == 0)
+    return;
 
-    ASSERT(indirect_iterator <= NUMBER_INDIRECT_POINTERS);
-  }
+  size_t iterator = 0;
+  const struct indirect_block *indirect_block =
+    filesys_cache_get(sector, false);
 
-  filesys_cache_write(*sectors, &double_indirect_block, 0, BLOCK_SECTOR_SIZE);
+  for (iterator = 0; iterator < NUMBER_INDIRECT_POINTERS; iterator++) {
+    if (indirect_block->block_pointers[iterator] != 0)
+      free_map_release (indirect_block->block_pointers[iterator], 1);
+  }
 
-  return success;
+  filesys_cache_put(indirect_block, false);
+  free_map_release (sector, 1);
 }
 
-
-/* grow the inode such that a write at offset of size size could be performed
-   successfully */
-bool
-inode_grow(struct inode *inode, struct inode_disk *inode_disk, off_t size,
-           off_t offset)
+/* deallocate the indirect blocks the doubly indirect block in sector points
+   to and the doubly indirect block itself, unless it is a hole */
+void
+inode_deallocate_double_indirect_sectors(block_sector_t sector)
 {
-  if (inode != NULL){
-    ASSERT(lock_held_by_current_thread(&inode->inode_extend_lock));
-  }
+  if (sector == 0)
+    return;
 
-  uint8_t zero_sector[BLOCK_SECTOR_SIZE]; 
-  int zero_iterator = 0;
-  for (zero_iterator = 0; zero_iterator < BLOCK_SECTOR_SIZE; zero_iterator++){
-    zero_sector[zero_iterator] = 0;
-  }
+  size_t iterator = 0;
+  const struct indirect_block *double_indirect_block =
+    filesys_cache_get(sector, false);
 
-  off_t length;
-  unsigned index_level;
-  off_t current_index;
-  off_t indirect_index;
-  off_t double_indirect_index;
-  block_sector_t *direct_pointers;
-  block_sector_t *indirect_pointers;
-  block_sector_t *double_indirect_pointers;
+  for (iterator = 0; iterator < NUMBER_INDIRECT_POINTERS; iterator++)
+    inode_deallocate_indirect_sectors(
+           double_indirect_block->block_pointers[iterator]);
+
+  filesys_cache_put(double_indirect_block, false);
+  free_map_release (sector, 1);
+}
 
 
+
+/* grows an inode in the extent format like inode_grow. The new sectors are
+   taken from runs next to the last sector of the inode and extend its last
+   extent as long as they are contiguous to it. If the disk fills up, the
+   extents are restored to what they were before and the sectors added are
+   released */
+static bool
+inode_grow_extents (struct inode *inode, struct inode_disk *inode_disk,
+                    off_t size, off_t offset)
+{
+  off_t length;
+  struct inode_extents *extents;
   if (inode != NULL) {
-    lock_acquire(&inode->inode_field_lock);
+    /* data_length only changes under inode_extend_lock, which is held.
+       inode_write_at takes inode_field_lock before it, so it must not be
+       taken here */
     length = inode->data_length;
-    index_level = inode->index_level;
-    direct_pointers = inode->direct_pointers;
-    indirect_pointers = inode->indirect_pointers;
-    double_indirect_pointers = inode->double_indirect_pointers;
-    current_index = inode->current_index;
-    indirect_index = inode->indirect_index;
-    double_indirect_index = inode->double_indirect_index;
-    lock_release(&inode->inode_field_lock);
+    extents = &inode->extents;
   } else {
     length = inode_disk->length;
-    index_level = inode_disk->index_level;
-    direct_pointers = inode_disk->direct_pointers;
-    indirect_pointers = inode_disk->indirect_pointers;
-    double_indirect_pointers = inode_disk->double_indirect_pointers;
-    current_index = inode_disk->current_index;
-    indirect_index = inode_disk->indirect_index;
-    double_indirect_index = inode_disk->double_indirect_index;
+    extents = &inode_disk->extents;
   }
 
   size_t num_of_used_sectors = number_of_sectors(length);
-
-  off_t new_size = size + offset;
-
-  size_t num_of_sectors_after = number_of_sectors(new_size);
-
+  size_t num_of_sectors_after = number_of_sectors(size + offset);
+  if (num_of_sectors_after <= num_of_used_sectors)
+    return true;
   size_t num_of_add_sectors = num_of_sectors_after - num_of_used_sectors;
 
-  if (num_of_add_sectors <= 0)
-    return true;
+  /* the extents before growing, restored on failure */
+  uint32_t old_cnt = extents->cnt;
+  block_sector_t old_index = extents->index;
+  struct inode_extent old_last;
+  if (old_cnt > 0)
+    extent_read(extents, old_cnt - 1, &old_last);
 
-  bool success = true;
+  struct inode_allocator allocator;
+  allocator_init(&allocator, num_of_add_sectors,
+                 inode != NULL ? inode->alloc_hint : 0);
 
-  if (index_level == 0){
-    while (num_of_add_sectors > 0 && current_index < NUMBER_DIRECT_BLOCKS) {
-      success &= free_map_allocate (1, &direct_pointers[current_index]);
-      filesys_cache_write(direct_pointers[current_index],
-                          zero_sector, 0, BLOCK_SECTOR_SIZE);
-      num_of_add_sectors -= 1;
-      current_index += 1;
-      num_of_used_sectors += 1;
-      length += BLOCK_SECTOR_SIZE;
+  bool success = true;
+  while (success && num_of_add_sectors > 0) {
+    block_sector_t sector;
+    success = allocator_next(&allocator, &sector);
+    if (success) {
+      success = extent_append(extents, sector, &allocator);
+      if (!success)
+        free_map_release(sector, 1);
     }
-
-    if (num_of_add_sectors > 0 && current_index == NUMBER_DIRECT_BLOCKS){
-      index_level = 1;
-      current_index = 0;
+    if (success) {
+      filesys_cache_zero(sector);
+      num_of_add_sectors -= 1;
     }
   }
+  if (!success)
+    extent_truncate(extents, old_cnt, &old_last, old_index);
 
-  bool first_iter = true;
-  if (index_level == 1){
-    while (num_of_add_sectors > 0 && current_index < NUMBER_INDIRECT_BLOCKS) {
-      size_t sectors_to_write = 0;
-      if (!first_iter)
-        indirect_index = 0;
+  block_sector_t alloc_hint = allocator_finish(&allocator);
+  if (inode != NULL)
+    inode->alloc_hint = alloc_hint;
+  return success;
+}
 
-      ASSERT(indirect_index < NUMBER_INDIRECT_POINTERS);
-      if ((num_of_add_sectors + indirect_index) > NUMBER_INDIRECT_POINTERS)
-        sectors_to_write = NUMBER_INDIRECT_POINTERS - indirect_index;
-      else
-        sectors_to_write = num_of_add_sectors;
-      
-      success &= inode_allocate_indirect_sectors(
-                    &indirect_pointers[current_index], sectors_to_write,
-                    indirect_index);
-
-      first_iter = false;
-      num_of_add_sectors -= sectors_to_write;
-      length += (sectors_to_write * BLOCK_SECTOR_SIZE);
-
-      indirect_index = sectors_to_write + indirect_index;
-      if (indirect_index == NUMBER_INDIRECT_POINTERS){
-        current_index += 1;
-        indirect_index = 0;
-      } else {
-        ASSERT(num_of_add_sectors == 0);
-      }
-    }
 
-    if (current_index == NUMBER_INDIRECT_BLOCKS){
-      ASSERT(indirect_index == 0);
-      index_level = 2;
-      current_index = 0;
-      indirect_index = 0;
+/* appends sector to the end of the file described by extents, extending
+   its last extent if sector follows it. The blocks needed to spill the
+   extents out of the inode are taken from allocator. Returns false if the
+   file has too many extents or the disk is full */
+static bool
+extent_append (struct inode_extents *extents, block_sector_t sector,
+               struct inode_allocator *allocator)
+{
+  struct inode_extent extent;
+  uint32_t cnt = extents->cnt;
+
+  if (cnt > 0) {
+    extent_read(extents, cnt - 1, &extent);
+    if (extent.start + extent.length == sector) {
+      extent.length += 1;
+      extent_write(extents, cnt - 1, &extent);
+      return true;
     }
   }
 
-  if (index_level == 2){
-    if (num_of_add_sectors > 0){
-      inode_allocate_double_indirect_sectors(
-               &double_indirect_pointers[current_index], num_of_add_sectors,
-               indirect_index, double_indirect_index);
+  if (cnt == MAX_EXTENTS)
+    return false;
 
-      length += num_of_add_sectors * BLOCK_SECTOR_SIZE;
+  if (cnt >= NUMBER_INLINE_EXTENTS) {
+    uint32_t leaf_index = cnt - NUMBER_INLINE_EXTENTS;
 
-      indirect_index = num_of_add_sectors / NUMBER_INDIRECT_POINTERS;
-      double_indirect_index = num_of_add_sectors % NUMBER_INDIRECT_POINTERS;
+    if (extents->index == 0) {
+      if (!allocator_next(allocator, &extents->index))
+        return false;
+      struct indirect_block *index_block =
+        filesys_cache_get(extents->index, true);
+      memset(index_block, 0, BLOCK_SECTOR_SIZE);
+      filesys_cache_put(index_block, true);
     }
-  }
-
-  ASSERT(DIV_ROUND_UP(new_size, BLOCK_SECTOR_SIZE) ==
-                       DIV_ROUND_UP(length, BLOCK_SECTOR_SIZE));
 
-  /* updating struct values */
-  if (inode != NULL) {
-    lock_acquire(&inode->inode_field_lock);
-    inode->index_level = index_level;
-    inode->current_index = current_index;
-    inode->indirect_index = indirect_index;
-    inode->double_indirect_index = double_indirect_index;
-    lock_release(&inode->inode_field_lock);
-  } else {
-    inode_disk->index_level = index_level;
-    inode_disk->current_index = current_index;
-    inode_disk->indirect_index = indirect_index;
-    inode_disk->double_indirect_index = double_indirect_index;
+    if (leaf_index % NUMBER_LEAF_EXTENTS == 0) {
+      block_sector_t leaf_sector;
+      if (!allocator_next(allocator, &leaf_sector))
+        return false;
+      struct extent_block *leaf = filesys_cache_get(leaf_sector, true);
+      memset(leaf, 0, BLOCK_SECTOR_SIZE);
+      filesys_cache_put(leaf, true);
+
+      struct indirect_block *index_block =
+        filesys_cache_get(extents->index, true);
+      index_block->block_pointers[leaf_index / NUMBER_LEAF_EXTENTS] =
+        leaf_sector;
+      filesys_cache_put(index_block, true);
+    }
   }
 
-  return success;
-
+  extent.start = sector;
+  extent.length = 1;
+  extent_write(extents, cnt, &extent);
+  /* readers only look at the extents below cnt */
+  extents->cnt = cnt + 1;
+  return true;
 }
 
 
-void
-inode_deallocate (struct inode *inode)
+/* shrinks extents back to its first cnt extents after a failed growth, the
+   last of which was last before, and releases the sectors added behind
+   them together with the extent blocks allocated for them. index is the
+   extent index block before the growth */
+static void
+extent_truncate (struct inode_extents *extents, uint32_t cnt,
+                 const struct inode_extent *last, block_sector_t index)
 {
-  lock_acquire(&inode->inode_field_lock);
-  off_t length = inode->data_length;
-  unsigned index_level = inode->index_level;
-  block_sector_t *direct_pointers = inode->direct_pointers;
-  block_sector_t *indirect_pointers = inode->indirect_pointers;
-  block_sector_t *double_indirect_pointers = inode->double_indirect_pointers;
-  off_t current_index = inode->current_index;
-  lock_release(&inode->inode_field_lock);
-
-  size_t num_of_sectors = number_of_sectors(length);
-
-  if (index_level > 0) {
-    /* free all direct ones */
-    int iter = 0;
-    while (iter < NUMBER_DIRECT_BLOCKS) {
-      free_map_release (direct_pointers[iter], 1);
-      num_of_sectors -= 1;
-      iter += 1;
-    }
-  } else {
-    /* free all allocated direct ones */
-    int iter = 0;
-    while (iter < current_index) {
-      free_map_release (direct_pointers[iter], 1);
-      num_of_sectors -= 1;
-      iter += 1;
+  uint32_t grown_cnt = extents->cnt;
+  struct inode_extent extent;
+  uint32_t i;
+
+  /* readers only look at the extents below cnt */
+  extents->cnt = cnt;
+
+  if (cnt > 0) {
+    extent_read(extents, cnt - 1, &extent);
+    if (extent.length > last->length) {
+      free_map_release(last->start + last->length,
+                       extent.length - last->length);
+      extent_write(extents, cnt - 1, last);
     }
   }
+  for (i = cnt; i < grown_cnt; i++) {
+    extent_read(extents, i, &extent);
+    free_map_release(extent.start, extent.length);
+  }
 
-  if (index_level > 1) {
-    /* free all indirect ones */
-    int iter = 0;
-    while (iter < NUMBER_DIRECT_BLOCKS) {
-      inode_deallocate_indirect_sectors(&indirect_pointers[iter],
-                                        NUMBER_INDIRECT_POINTERS);
-      num_of_sectors -= NUMBER_INDIRECT_POINTERS;
-      iter += 1;
-    }
-  } else if (index_level == 1) {
-    /* free all allocated indirect ones */
-    int iter = 0;
-    while (iter < current_index) {
-      size_t sectors_to_delete = 0;
-      if (num_of_sectors > NUMBER_INDIRECT_POINTERS)
-        sectors_to_delete = NUMBER_INDIRECT_POINTERS;
-      else
-        sectors_to_delete = num_of_sectors;
-      inode_deallocate_indirect_sectors(&indirect_pointers[iter],
-                                        sectors_to_delete);
-      num_of_sectors -= sectors_to_delete;
-      iter += 1;
+  if (extents->index != 0) {
+    struct indirect_block *index_block =
+      filesys_cache_get(extents->index, true);
+    for (i = extent_leaf_cnt(cnt); i < extent_leaf_cnt(grown_cnt); i++) {
+      free_map_release(index_block->block_pointers[i], 1);
+      index_block->block_pointers[i] = 0;
     }
-  }
+    filesys_cache_put(index_block, true);
 
-  /* free all allocated double indirect ones */
-  if (index_level == 2 && num_of_sectors > 0) {
-    ASSERT(current_index == 0);
-    inode_deallocate_double_indirect_sectors(
-                  &double_indirect_pointers[current_index], num_of_sectors);
+    if (index == 0) {
+      free_map_release(extents->index, 1);
+      extents->index = 0;
+    }
   }
 }
 
 
-/* deallocate num_of_sectors indirect blocks in sectors */
-void
-inode_deallocate_indirect_sectors(block_sector_t *sectors,
-                                  size_t num_of_sectors)
+/* returns the number of extent leaf blocks of a file with cnt extents */
+static size_t
+extent_leaf_cnt (uint32_t cnt)
 {
-  size_t iterator = 0;
-  struct indirect_block indirect_block;
+  if (cnt <= NUMBER_INLINE_EXTENTS)
+    return 0;
+  return DIV_ROUND_UP(cnt - NUMBER_INLINE_EXTENTS, NUMBER_LEAF_EXTENTS);
+}
 
-  filesys_cache_read(*sectors, &indirect_block, 0, BLOCK_SECTOR_SIZE);
 
-  for (iterator = 0; iterator < num_of_sectors; iterator++) {
-    free_map_release (indirect_block.block_pointers[iterator], 1);
+/* reads extent i of extents into extent, from the inode or from the leaf
+   block holding it */
+static void
+extent_read (const struct inode_extents *extents, uint32_t i,
+             struct inode_extent *extent)
+{
+  if (i < NUMBER_INLINE_EXTENTS) {
+    *extent = extents->inline_extents[i];
+    return;
   }
 
-  free_map_release (*sectors, 1);
+  i -= NUMBER_INLINE_EXTENTS;
+  const struct indirect_block *index_block =
+    filesys_cache_get(extents->index, false);
+  block_sector_t leaf_sector =
+    index_block->block_pointers[i / NUMBER_LEAF_EXTENTS];
+  filesys_cache_put(index_block, false);
+
+  const struct extent_block *leaf = filesys_cache_get(leaf_sector, false);
+  *extent = leaf->extents[i % NUMBER_LEAF_EXTENTS];
+  filesys_cache_put(leaf, false);
 }
 
-/* deallocate num_of_sectors doubly indirect blocks in sectors */
-void
-inode_deallocate_double_indirect_sectors(block_sector_t *sectors,
-                                         size_t num_of_sectors)
+
+/* stores extent as extent i of extents, whose leaf block must exist */
+static void
+extent_write (struct inode_extents *extents, uint32_t i,
+              const struct inode_extent *extent)
 {
-  size_t iterator = 0;
-  struct indirect_block double_indirect_block;
+  if (i < NUMBER_INLINE_EXTENTS) {
+    extents->inline_extents[i] = *extent;
+    return;
+  }
 
-  filesys_cache_read(*sectors, &double_indirect_block, 0, BLOCK_SECTOR_SIZE);
+  i -= NUMBER_INLINE_EXTENTS;
+  const struct indirect_block *index_block =
+    filesys_cache_get(extents->index, false);
+  block_sector_t leaf_sector =
+    index_block->block_pointers[i / NUMBER_LEAF_EXTENTS];
+  filesys_cache_put(index_block, false);
 
-  while (num_of_sectors > 0) {
-    size_t sectors_to_delete = 0;
-    if (num_of_sectors > NUMBER_INDIRECT_POINTERS)
-      sectors_to_delete = NUMBER_INDIRECT_POINTERS;
-    else
-      sectors_to_delete = num_of_sectors;
+  struct extent_block *leaf = filesys_cache_get(leaf_sector, true);
+  leaf->extents[i % NUMBER_LEAF_EXTENTS] = *extent;
+  filesys_cache_put(leaf, true);
+}
 
-    inode_deallocate_indirect_sectors(
-           &double_indirect_block.block_pointers[iterator], sectors_to_delete);
 
-    num_of_sectors -= sectors_to_delete;
-    iterator += 1;
+/* releases the data sectors and extent blocks of an inode in the extent
+   format */
+static void
+inode_deallocate_extents (struct inode_extents *extents)
+{
+  uint32_t i;
+  for (i = 0; i < extents->cnt; i++) {
+    struct inode_extent extent;
+    extent_read(extents, i, &extent);
+    free_map_release(extent.start, extent.length);
   }
 
-  free_map_release (*sectors, 1);
+  if (extents->index != 0) {
+    const struct indirect_block *index_block =
+      filesys_cache_get(extents->index, false);
+    size_t leaf_cnt = extent_leaf_cnt(extents->cnt);
+    for (i = 0; i < leaf_cnt; i++)
+      free_map_release(index_block->block_pointers[i], 1);
+    filesys_cache_put(index_block, false);
+    free_map_release(extents->index, 1);
+  }
 }
 
 
-
 /* Returns the number of sectors to allocate for an inode SIZE
    bytes long. */
 size_t
@@ -500,11 +661,11 @@ number_of_sectors (off_t size)
 
 
 /* Returns the block device sector that contains byte offset POS
-   within INODE.
+   within INODE, 0 if POS lies in a hole.
    Returns -1 if INODE does not contain data for a byte at offset
    POS. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) 
+byte_to_sector (struct inode *inode, off_t pos) 
 {
   ASSERT (inode != NULL);
 
@@ -512,6 +673,9 @@ byte_to_sector (const struct inode *inode, off_t pos)
     return -1;
   }
 
+  if (inode->extent_format)
+    return byte_to_sector_extents(inode, pos);
+
   uint32_t index;
   block_sector_t return_sector = -1;
 
@@ -539,12 +703,59 @@ byte_to_sector (const struct inode *inode, off_t pos)
 }
 
 
-/* return the block sector from indirect block */
+/* return the block sector from the extents of the inode. The extents are
+   searched in order, so a contiguous file maps with a single lookup in
+   memory. The extents spilled into leaf blocks are searched a leaf at a
+   time, the index block and each leaf block are read once per lookup */
 static block_sector_t
-byte_to_sector_indirect (const struct inode *inode, off_t pos)
+byte_to_sector_extents (const struct inode *inode, off_t pos)
 {
-  struct indirect_block temp_indirect_block;
+  const struct inode_extents *extents = &inode->extents;
+  uint32_t block = pos / BLOCK_SECTOR_SIZE;
+  uint32_t cnt = extents->cnt;
+  uint32_t i;
+
+  for (i = 0; i < cnt && i < NUMBER_INLINE_EXTENTS; i++) {
+    const struct inode_extent *extent = &extents->inline_extents[i];
+    if (block < extent->length)
+      return extent->start + block;
+    block -= extent->length;
+  }
+  if (cnt <= NUMBER_INLINE_EXTENTS)
+    return -1;
+
+  block_sector_t sector = -1;
+  uint32_t spilled_cnt = cnt - NUMBER_INLINE_EXTENTS;
+  uint32_t leaf_index;
+  const struct indirect_block *index_block =
+    filesys_cache_get(extents->index, false);
+  for (leaf_index = 0; leaf_index * NUMBER_LEAF_EXTENTS < spilled_cnt
+                       && sector == (block_sector_t) -1; leaf_index++) {
+    uint32_t leaf_cnt = spilled_cnt - leaf_index * NUMBER_LEAF_EXTENTS;
+    if (leaf_cnt > NUMBER_LEAF_EXTENTS)
+      leaf_cnt = NUMBER_LEAF_EXTENTS;
+
+    const struct extent_block *leaf =
+      filesys_cache_get(index_block->block_pointers[leaf_index], false);
+    for (i = 0; i < leaf_cnt; i++) {
+      const struct inode_extent *extent = &leaf->extents[i];
+      if (block < extent->length) {
+        sector = extent->start + block;
+        break;
+      }
+      block -= extent->length;
+    }
+    filesys_cache_put(leaf, false);
+  }
+  filesys_cache_put(index_block, false);
+  return sector;
+}
+
 
+/* return the block sector from indirect block */
+static block_sector_t
+byte_to_sector_indirect (struct inode *inode, off_t pos)
+{
   off_t indirect_pos = pos - (NUMBER_DIRECT_BLOCKS * BLOCK_SECTOR_SIZE);
 
   off_t current_index = (indirect_pos / BLOCK_SECTOR_SIZE)
@@ -552,32 +763,74 @@ byte_to_sector_indirect (const struct inode *inode, off_t pos)
   off_t indirect_index = (indirect_pos / BLOCK_SECTOR_SIZE)
                               % NUMBER_INDIRECT_POINTERS;
 
-  /* read the indirect block into temporary representation */
-  filesys_cache_read(inode->indirect_pointers[current_index], &temp_indirect_block, 0, BLOCK_SECTOR_SIZE);
-
-  return temp_indirect_block.block_pointers[indirect_index];
+  return block_map_lookup(inode, current_index, indirect_index);
 }
 
 
 /* return the block sector from double indirect block */
 static block_sector_t
-byte_to_sector_double_indirect (const struct inode *inode, off_t pos)
+byte_to_sector_double_indirect (struct inode *inode, off_t pos)
 {
-  struct indirect_block temp_indirect_block;
-  struct indirect_block temp_double_indirect_block;
-
   off_t double_indirect_pos = pos - (NUMBER_DIRECT_BLOCKS * BLOCK_SECTOR_SIZE) - (NUMBER_INDIRECT_BLOCKS * NUMBER_INDIRECT_POINTERS * BLOCK_SECTOR_SIZE);
 
-  off_t current_index = 0;
   off_t indirect_index = (double_indirect_pos / BLOCK_SECTOR_SIZE) / NUMBER_INDIRECT_POINTERS;
+  off_t double_indirect_index = (double_indirect_pos / BLOCK_SECTOR_SIZE) % NUMBER_INDIRECT_POINTERS;
 
-  /* read the double indirect block into temporary representation */
-  filesys_cache_read(inode->double_indirect_pointers[current_index], &temp_double_indirect_block, 0, BLOCK_SECTOR_SIZE);
+  /* the indirect blocks below the double indirect block follow the
+     NUMBER_INDIRECT_BLOCKS indirect blocks of the inode in file order */
+  return block_map_lookup(inode, NUMBER_INDIRECT_BLOCKS + indirect_index,
+                          double_indirect_index);
+}
 
-  /* read the correct indirect block into temporary representation */
-  filesys_cache_read(temp_double_indirect_block.block_pointers[indirect_index], &temp_indirect_block, 0, BLOCK_SECTOR_SIZE);
 
-  return temp_indirect_block.block_pointers[double_indirect_pos];
+/* returns pointer index of the leaf-th indirect block of the inode in file
+   order, counting the indirect blocks below the double indirect block after
+   the ones in the inode. The indirect block is decoded into the block map
+   copy of the inode on a miss, the double indirect block is only read then */
+static block_sector_t
+block_map_lookup (struct inode *inode, int leaf, off_t index)
+{
+  lock_acquire(&inode->block_map_lock);
+  if (inode->block_map_leaf != leaf) {
+    block_sector_t indirect_sector = 0;
+    if (leaf < NUMBER_INDIRECT_BLOCKS) {
+      indirect_sector = inode->indirect_pointers[leaf];
+    } else if (inode->double_indirect_pointers[0] != 0) {
+      const struct indirect_block *double_indirect_block =
+        filesys_cache_get(inode->double_indirect_pointers[0], false);
+      indirect_sector =
+        double_indirect_block->block_pointers[leaf - NUMBER_INDIRECT_BLOCKS];
+      filesys_cache_put(double_indirect_block, false);
+    }
+
+    /* a missing indirect block maps a hole */
+    if (indirect_sector == 0) {
+      memset(inode->block_map, 0, sizeof inode->block_map);
+    } else {
+      const struct indirect_block *indirect_block =
+        filesys_cache_get(indirect_sector, false);
+      memcpy(inode->block_map, indirect_block->block_pointers,
+             sizeof inode->block_map);
+      filesys_cache_put(indirect_block, false);
+    }
+    inode->block_map_leaf = leaf;
+  }
+  block_sector_t sector = inode->block_map[index];
+  lock_release(&inode->block_map_lock);
+
+  return sector;
+}
+
+
+/* drops the block map copy of the inode after its indirect blocks changed.
+   A copy decoded concurrently is either complete or dropped here, because
+   the changes are made before */
+static void
+block_map_invalidate (struct inode *inode)
+{
+  lock_acquire(&inode->block_map_lock);
+  inode->block_map_leaf = -1;
+  lock_release(&inode->block_map_lock);
 }
 
 
@@ -598,26 +851,36 @@ inode_create (block_sector_t sector, off_t length, bool directory)
      one sector in size, and you should fix that. */
   ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
 
+  /* the sector might have held an inode which was freed without being
+     removed, whose closed copy must not be reopened instead of this one */
+  forget_closed_inode (sector);
+
   disk_inode = calloc (1, sizeof *disk_inode);
   if (disk_inode != NULL)
     {
       disk_inode->length = 0;
-      disk_inode->index_level = 0;
-      disk_inode->current_index = 0;
-      disk_inode->indirect_index = 0;
-      disk_inode->double_indirect_index = 0;
-      disk_inode->directory = directory;
+      disk_inode->directory = directory ? INODE_DIR_RECORDS : 0;
       disk_inode->parent = PARENT_MAGIC;
-      inode_grow(NULL, disk_inode, length, 0);
-      disk_inode->length = length;
-      if (length > MAX_FILESIZE)
-        disk_inode->length = MAX_FILESIZE;
-      else
+      free_map_begin_batch();
+      bool allocated;
+      if (inode_use_extents) {
+        /* the extent format has no size limit besides off_t */
+        disk_inode->magic = INODE_EXTENT_MAGIC;
+        allocated = inode_grow(NULL, disk_inode, length, 0);
         disk_inode->length = length;
+      } else {
+        /* the file consists of holes until it is written */
+        if (length > MAX_FILESIZE)
+          disk_inode->length = MAX_FILESIZE;
+        else
+          disk_inode->length = length;
 
-      disk_inode->magic = INODE_MAGIC;
+        disk_inode->magic = INODE_MAGIC;
 
-      if (inode_allocate (disk_inode))
+        allocated = true;
+      }
+      free_map_end_batch();
+      if (allocated)
         {
           filesys_cache_write(sector, disk_inode, 0, BLOCK_SECTOR_SIZE);
           success = true; 
@@ -627,74 +890,126 @@ inode_create (block_sector_t sector, off_t length, bool directory)
           success = false;
         }
       free (disk_inode);
+
+      /* the free map file is written while the free map is locked, so it
+         must never allocate a block */
+      if (success && sector == FREE_MAP_SECTOR && !inode_use_extents)
+        success = inode_fill_holes (sector);
     }
   return success;
 }
 
+/* allocates every hole of the inode in sector. Returns false if the disk
+   is full or memory allocation fails */
+static bool
+inode_fill_holes (block_sector_t sector)
+{
+  struct inode *inode = inode_open (sector);
+  struct inode_allocator allocator;
+  bool success = inode != NULL;
+  off_t pos;
+
+  if (!success)
+    return false;
+  allocator_init (&allocator, number_of_sectors (inode->data_length),
+                  inode->alloc_hint);
+  for (pos = 0; success && pos < inode->data_length;
+       pos += BLOCK_SECTOR_SIZE)
+    success = byte_to_sector (inode, pos) != 0
+              || inode_fill_hole (inode, pos, &allocator) != 0;
+  allocator_finish (&allocator);
+  inode_close (inode);
+  return success;
+}
+
 /* Reads an inode from SECTOR
    and returns a `struct inode' that contains it.
    Returns a null pointer if memory allocation fails. */
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
   struct inode *inode;
 
-  /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  /* Check whether this inode is already open. An inode which is still
+     read in is used once it is complete, one which is written back after
+     its last close is opened anew afterwards. */
+  lock_acquire (&open_inodes_lock);
+  while ((inode = open_inodes_find (sector)) != NULL && inode->busy)
+    cond_wait (&open_inodes_cond, &open_inodes_lock);
+  if (inode != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
-        {
-          inode_reopen (inode);
-          return inode; 
-        }
+      /* reopening a closed inode takes it off the closed list */
+      if (inode->open_cnt++ == 0)
+        list_remove (&inode->closed_elem);
+      lock_release (&open_inodes_lock);
+      return inode;
     }
 
-  /* Allocate memory. */
-  inode = malloc (sizeof *inode);
-  if (inode == NULL)
-    return NULL;
+  /* Allocate memory, making room by dropping closed inodes if necessary. */
+  while ((inode = malloc (sizeof *inode)) == NULL)
+    if (!reclaim_closed_inode ())
+      {
+        lock_release (&open_inodes_lock);
+        return NULL;
+      }
 
-  /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
-  inode->index_level = 0;
-  inode->current_index = 0;
-  inode->indirect_index = 0;
-  inode->double_indirect_index = 0;
+  /* Initialize. Other openers wait until the inode is read in, the table is
+     not locked meanwhile. */
   inode->sector = sector;
   inode->open_cnt = 1;
+  inode->busy = true;
+  hash_insert (&open_inodes, &inode->elem);
+  lock_release (&open_inodes_lock);
+
   inode->deny_write_cnt = 0;
   inode->removed = false;
   inode->parent = PARENT_MAGIC;
   inode->directory = false;
+  inode->old_dir_format = false;
+  inode->hashed_dir = false;
   lock_init(&inode->inode_extend_lock);
   lock_init(&inode->inode_field_lock);
   lock_init(&inode->inode_directory_lock);
-
-  /* read inode from disk into disk_data */
-  struct inode_disk disk_data;
-  filesys_cache_read(inode->sector, &disk_data, 0, BLOCK_SECTOR_SIZE);
-  inode->data_length = disk_data.length;
-  inode->reader_length = disk_data.length;
-  inode->index_level = disk_data.index_level;
-  inode->current_index = disk_data.current_index;
-  inode->indirect_index = disk_data.indirect_index;
-  inode->double_indirect_index = disk_data.double_indirect_index;
-  inode->directory = disk_data.directory;
-  inode->parent = disk_data.parent;
+  lock_init(&inode->block_map_lock);
+  inode->block_map_leaf = -1;
+  inode->dirty = false;
+  inode->dir_free_hint = 0;
+
+  /* read inode fields in place from the cached disk_data */
+  const struct inode_disk *disk_data = filesys_cache_get(inode->sector, false);
+  inode->data_length = disk_data->length;
+  inode->reader_length = disk_data->length;
+  inode->directory = disk_data->directory != 0;
+  inode->old_dir_format = disk_data->directory == INODE_DIR_SLOTS;
+  inode->hashed_dir = disk_data->directory == INODE_DIR_HASHED;
+  inode->parent = disk_data->parent;
+  inode->extent_format = disk_data->magic == INODE_EXTENT_MAGIC;
+  if (inode->extent_format)
+    memcpy(&inode->extents, &disk_data->extents, sizeof inode->extents);
 
   /* amount of bytes contained in a sector */
   int bytes_per_block_sector = sizeof(block_sector_t);
 
   /* copy the entire segment of block_points from disk_data into inode */
-  memcpy(&inode->direct_pointers, &disk_data.direct_pointers,
+  memcpy(&inode->direct_pointers, &disk_data->direct_pointers,
          NUMBER_DIRECT_BLOCKS * bytes_per_block_sector);
-  memcpy(&inode->indirect_pointers, &disk_data.indirect_pointers,
+  memcpy(&inode->indirect_pointers, &disk_data->indirect_pointers,
          NUMBER_INDIRECT_BLOCKS * bytes_per_block_sector);
-  memcpy(&inode->double_indirect_pointers, &disk_data.double_indirect_pointers,
+  memcpy(&inode->double_indirect_pointers, &disk_data->double_indirect_pointers,
          NUMBER_DOUBLE_INDIRECT_BLOCKS * bytes_per_block_sector);
+  filesys_cache_put(disk_data, false);
+
+  /* growing continues behind the last data block, or behind the inode if
+     there is none */
+  block_sector_t last_sector = 0;
+  if (inode->data_length > 0)
+    last_sector = byte_to_sector(inode, inode->data_length - 1);
+  inode->alloc_hint = last_sector != 0 ? last_sector + 1 : sector + 1;
+
+  lock_acquire (&open_inodes_lock);
+  inode->busy = false;
+  cond_broadcast (&open_inodes_cond, &open_inodes_lock);
+  lock_release (&open_inodes_lock);
 
   return inode;
 }
@@ -704,7 +1019,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
@@ -725,10 +1044,33 @@ inode_close (struct inode *inode)
   if (inode == NULL)
     return;
 
-  /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+  /* Release resources if this was the last opener. The inode stays in
+     open_inodes until it is written back, so that it is not read in again
+     meanwhile. */
+  lock_acquire (&open_inodes_lock);
+  bool last = --inode->open_cnt == 0;
+  if (last)
+    inode->busy = true;
+  lock_release (&open_inodes_lock);
+
+  if (last)
     {
-      inode_writeback(inode);
+      /* removed inodes are deallocated, all others are kept for being
+         reopened */
+      if (inode->removed)
+        {
+          inode_writeback(inode);
+          return;
+        }
+      inode_store (inode);
+
+      lock_acquire (&open_inodes_lock);
+      inode->busy = false;
+      list_push_back (&closed_inodes, &inode->closed_elem);
+      if (list_size (&closed_inodes) > CLOSED_INODES_MAX)
+        reclaim_closed_inode ();
+      cond_broadcast (&open_inodes_cond, &open_inodes_lock);
+      lock_release (&open_inodes_lock);
     }
 }
 
@@ -740,41 +1082,92 @@ inode_writeback (struct inode *inode)
   if (inode == NULL)
     return;
 
-  /* Remove from inode list and release lock. */
-  list_remove (&inode->elem);
-
   /* Deallocate blocks if removed. */
   if (inode->removed) 
     {
+      free_map_begin_batch();
       free_map_release (inode->sector, 1);
       inode_deallocate(inode);
+      free_map_end_batch();
     }
   else
-    { 
-      /* write back to disk */
-      struct inode_disk inode_disk;
-      inode_disk.length = inode->data_length;
-      inode_disk.index_level = inode->index_level;
-      inode_disk.current_index = inode->current_index;
-      inode_disk.indirect_index = inode->indirect_index;
-      inode_disk.double_indirect_index = inode->double_indirect_index;
-      inode_disk.directory = inode->directory;
-      inode_disk.magic = INODE_MAGIC;
-      inode_disk.directory = inode->directory;
-      inode_disk.parent = inode->parent;
-      memcpy(&inode_disk.direct_pointers, &inode->direct_pointers,
-             NUMBER_DIRECT_BLOCKS * sizeof(block_sector_t));
-      memcpy(&inode_disk.indirect_pointers, &inode->indirect_pointers,
-             NUMBER_INDIRECT_BLOCKS * sizeof(block_sector_t));
-      memcpy(&inode_disk.double_indirect_pointers,
-             &inode->double_indirect_pointers,
-             NUMBER_DOUBLE_INDIRECT_BLOCKS * sizeof(block_sector_t));
-      filesys_cache_write(inode->sector, &inode_disk, 0, BLOCK_SECTOR_SIZE);
-    }
+    inode_store (inode);
+
+  /* Remove from open inodes and wake up the threads which wait to open it
+     again. */
+  lock_acquire (&open_inodes_lock);
+  hash_delete (&open_inodes, &inode->elem);
+  cond_broadcast (&open_inodes_cond, &open_inodes_lock);
+  lock_release (&open_inodes_lock);
 
   free (inode); 
 }
 
+/* writes the metadata of inode to its on-disk inode unless it is unchanged,
+   so that inodes which were only read are never written */
+static void
+inode_store (struct inode *inode)
+{
+  if (!inode->dirty)
+    return;
+  inode->dirty = false;
+
+  /* write back to disk by updating the cached inode_disk in place */
+  struct inode_disk *inode_disk = filesys_cache_get(inode->sector, true);
+  inode_disk->length = inode->data_length;
+  inode_disk->magic = inode->extent_format ? INODE_EXTENT_MAGIC
+                                           : INODE_MAGIC;
+  if (inode->extent_format)
+    memcpy(&inode_disk->extents, &inode->extents, sizeof inode->extents);
+  inode_disk->parent = inode->parent;
+  memcpy(&inode_disk->direct_pointers, &inode->direct_pointers,
+         NUMBER_DIRECT_BLOCKS * sizeof(block_sector_t));
+  memcpy(&inode_disk->indirect_pointers, &inode->indirect_pointers,
+         NUMBER_INDIRECT_BLOCKS * sizeof(block_sector_t));
+  memcpy(&inode_disk->double_indirect_pointers,
+         &inode->double_indirect_pointers,
+         NUMBER_DOUBLE_INDIRECT_BLOCKS * sizeof(block_sector_t));
+  filesys_cache_put(inode_disk, true);
+}
+
+/* frees the least recently closed inode of closed_inodes. Returns false if
+   there is none. open_inodes_lock must be held */
+static bool
+reclaim_closed_inode (void)
+{
+  ASSERT (lock_held_by_current_thread (&open_inodes_lock));
+  if (list_empty (&closed_inodes))
+    return false;
+
+  struct inode *inode = list_entry (list_pop_front (&closed_inodes),
+                                    struct inode, closed_elem);
+  ASSERT (inode->open_cnt == 0 && !inode->busy);
+  hash_delete (&open_inodes, &inode->elem);
+  free (inode);
+  return true;
+}
+
+/* frees the closed inode of sector kept in closed_inodes, if there is one.
+   An inode still written back after its last close is waited for. The
+   inode must not be open */
+static void
+forget_closed_inode (block_sector_t sector)
+{
+  struct inode *inode;
+
+  lock_acquire (&open_inodes_lock);
+  while ((inode = open_inodes_find (sector)) != NULL && inode->busy)
+    cond_wait (&open_inodes_cond, &open_inodes_lock);
+  if (inode != NULL)
+    {
+      ASSERT (inode->open_cnt == 0);
+      list_remove (&inode->closed_elem);
+      hash_delete (&open_inodes, &inode->elem);
+      free (inode);
+    }
+  lock_release (&open_inodes_lock);
+}
+
 /* Marks INODE to be deleted when it is closed by the last caller who
    has it open. */
 void
@@ -784,16 +1177,105 @@ inode_remove (struct inode *inode)
   inode->removed = true;
 }
 
+/* Returns the cached content of the sector holding byte offset POS of INODE
+   without copying it, see filesys_cache_get. The caller has to release it
+   with filesys_cache_put. Returns NULL if POS is not below the length of
+   INODE which can already be used by readers, or if it lies in a hole,
+   which reads as zeros. */
+const void *
+inode_get_sector (struct inode *inode, off_t pos)
+{
+  lock_acquire(&inode->inode_field_lock);
+  bool past_end = pos >= inode_reader_length(inode);
+  lock_release(&inode->inode_field_lock);
+  if (past_end)
+    return NULL;
+
+  /* reading a hole does not allocate it */
+  block_sector_t sector = byte_to_sector (inode, pos);
+  if (sector == 0)
+    return NULL;
+  return filesys_cache_get(sector, false);
+}
+
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
    Returns the number of bytes actually read, which may be less
    than SIZE if an error occurs or end of file is reached. */
 off_t
 inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) 
+{
+  return inode_read_stream_at (inode, buffer_, size, offset, NULL);
+}
+
+/* Initializes the read-ahead state of a new reader, which is expected to
+   start reading at offset 0. */
+void
+inode_read_ahead_init (struct inode_read_ahead *read_ahead)
+{
+  read_ahead->next_pos = 0;
+  read_ahead->window = 0;
+  read_ahead->queued_end = 0;
+}
+
+/* Updates READ_AHEAD for a read at OFFSET. A read which continues where the
+   previous one ended doubles the read-ahead window up to
+   READ_AHEAD_MAX_WINDOW blocks, any other read stops read-ahead. */
+static void
+read_ahead_detect_stream (struct inode_read_ahead *read_ahead, off_t offset)
+{
+  if (offset == read_ahead->next_pos)
+    {
+      if (read_ahead->window == 0)
+        read_ahead->window = 1;
+      else if (read_ahead->window < READ_AHEAD_MAX_WINDOW)
+        read_ahead->window *= 2;
+    }
+  else
+    {
+      read_ahead->window = 0;
+      read_ahead->queued_end = 0;
+    }
+}
+
+/* Queues the blocks of INODE in the read-ahead window behind END, the end
+   of the last read, which were not queued yet. The sectors are taken from
+   the block map of INODE, so that read-ahead follows the file and not the
+   disk. Blocks which do not fit into the read-ahead queue are queued by a
+   later read. */
+static void
+read_ahead_queue_window (struct inode *inode,
+                         struct inode_read_ahead *read_ahead, off_t end)
+{
+  off_t start = ROUND_UP (end, BLOCK_SECTOR_SIZE);
+  off_t window_end = start + read_ahead->window * BLOCK_SECTOR_SIZE;
+  off_t length = inode_reader_length (inode);
+  if (window_end > length)
+    window_end = length;
+
+  off_t pos = read_ahead->queued_end > start ? read_ahead->queued_end : start;
+  for (; pos < window_end; pos += BLOCK_SECTOR_SIZE)
+    {
+      /* holes are read without the disk */
+      block_sector_t sector = byte_to_sector (inode, pos);
+      if (sector != 0 && !filesys_cache_queue_read_ahead (sector))
+        break;
+    }
+  read_ahead->queued_end = pos;
+}
+
+/* Reads like inode_read_at on behalf of a reader with the read-ahead state
+   READ_AHEAD, which may be NULL if the reader does not want read-ahead. */
+off_t
+inode_read_stream_at (struct inode *inode, void *buffer_, off_t size,
+                      off_t offset, struct inode_read_ahead *read_ahead)
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
   uint8_t *bounce = NULL;
 
+  if (read_ahead != NULL)
+    read_ahead_detect_stream (read_ahead, offset);
+
   /* cant read past size of inode */
   lock_acquire(&inode->inode_field_lock);
   if (inode_reader_length(inode) <= offset) {
@@ -818,8 +1300,11 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      filesys_cache_read(sector_idx, buffer + bytes_read,
-                         sector_ofs, chunk_size);
+      if (sector_idx == 0)
+        memset (buffer + bytes_read, 0, chunk_size);
+      else
+        filesys_cache_read(sector_idx, buffer + bytes_read,
+                           sector_ofs, chunk_size);
 
       /* Advance. */
       size -= chunk_size;
@@ -828,6 +1313,13 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
     }
   free(bounce);
 
+  if (read_ahead != NULL)
+    {
+      read_ahead->next_pos = offset;
+      if (read_ahead->window > 0)
+        read_ahead_queue_window (inode, read_ahead, offset);
+    }
+
   return bytes_read;
 }
 
@@ -841,11 +1333,12 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset) 
 {
   bool was_extended = false;
+  bool batch = false;
   off_t new_length_after_extend;
 
   if (inode->deny_write_cnt)
     return 0;
- 
+
   lock_acquire(&inode->inode_field_lock);
   new_length_after_extend = inode->data_length;
   if (size + offset > inode->data_length){
@@ -858,12 +1351,18 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
     }
 
     lock_release(&inode->inode_field_lock);
+    /* the sectors allocated while growing and for the holes written below
+       are written to the free map file at once */
+    free_map_begin_batch();
+    batch = true;
     if (inode_grow (inode, NULL, size, offset)){
       inode->data_length = size + offset;
+      inode->dirty = true;
       new_length_after_extend = size + offset;
       was_extended = true;
     } else {
       lock_release(&inode->inode_extend_lock);
+      free_map_end_batch();
       return 0;
     }
   } else {
@@ -874,6 +1373,12 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
 
+  /* the holes of the written range, for a growing inode the blocks from its
+     old end on, are requested as a single run */
+  struct inode_allocator allocator;
+  allocator_init(&allocator,
+                 number_of_sectors(offset + size) - offset / BLOCK_SECTOR_SIZE,
+                 inode->alloc_hint);
 
   while (size > 0) 
     {
@@ -881,6 +1386,21 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       block_sector_t sector_idx = byte_to_sector (inode, offset);
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
+      /* a hole gets its block on the first write, stop if the disk is
+         full. The free map file never has holes, it is written while the
+         free map is locked */
+      if (sector_idx == 0)
+        {
+          if (!batch)
+            {
+              free_map_begin_batch();
+              batch = true;
+            }
+          sector_idx = inode_fill_hole (inode, offset, &allocator);
+        }
+      if (sector_idx == 0)
+        break;
+
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
       off_t inode_left = new_length_after_extend - offset;
       int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
@@ -904,6 +1424,10 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
     inode->reader_length = size + offset;
     lock_release(&inode->inode_extend_lock);
   }
+  /* the rest of the run is released within the batch */
+  allocator_finish(&allocator);
+  if (batch)
+    free_map_end_batch();
   return bytes_written;
 }
 
@@ -957,6 +1481,56 @@ inode_is_directory (struct inode *inode)
   return inode->directory;
 }
 
+/* returns true if inode is a directory written in the fixed-size entry
+   format of earlier versions */
+bool
+inode_has_old_dir_format (struct inode *inode)
+{
+  return inode->old_dir_format;
+}
+
+/* marks the directory inode as holding variable-length records, once its
+   fixed-size entries are rewritten */
+void
+inode_set_dir_records (struct inode *inode)
+{
+  ASSERT (inode->directory);
+  inode->old_dir_format = false;
+  struct inode_disk *inode_disk = filesys_cache_get(inode->sector, true);
+  inode_disk->directory = INODE_DIR_RECORDS;
+  filesys_cache_put(inode_disk, true);
+}
+
+/* returns true if inode is a directory in the hashed format */
+bool
+inode_has_hashed_dir_format (struct inode *inode)
+{
+  return inode->hashed_dir;
+}
+
+/* marks the directory inode as being in the hashed format, once the header
+   of the format is written */
+void
+inode_set_dir_hashed (struct inode *inode)
+{
+  ASSERT (inode->directory);
+  inode->hashed_dir = true;
+  struct inode_disk *inode_disk = filesys_cache_get(inode->sector, true);
+  inode_disk->directory = INODE_DIR_HASHED;
+  filesys_cache_put(inode_disk, true);
+}
+
+#ifdef FILESYS_TEST_HOOKS
+/* returns the sector holding byte offset pos of inode, 0 if it lies in a
+   hole or -1 if it is not below the length of inode. Only for the test
+   hooks of userprog/syscall.c */
+block_sector_t
+inode_byte_to_sector (struct inode *inode, off_t pos)
+{
+  return byte_to_sector(inode, pos);
+}
+#endif
+
 /* returns true if inode is marked as removed */
 bool
 inode_is_removed (struct inode *inode)
@@ -969,8 +1543,11 @@ int
 inode_get_open_count(struct inode *inode){
   if (inode == NULL)
     return -1;
-  else
-    return inode->open_cnt;
+
+  lock_acquire (&open_inodes_lock);
+  int open_cnt = inode->open_cnt;
+  lock_release (&open_inodes_lock);
+  return open_cnt;
 }
 
 /* sets the parent of inode to passed parent inode. Returns true if
@@ -982,5 +1559,6 @@ inode_set_parent_to_inode (struct inode *inode, struct inode *parent)
     return false;
 
   inode->parent = inode_get_inumber(parent);
+  inode->dirty = true;
   return true;
 }
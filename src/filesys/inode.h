@@ -2,6 +2,7 @@
 #define FILESYS_INODE_H
 
 #include <stdbool.h>
+#include <hash.h>
 #include <list.h>
 #include "filesys/off_t.h"
 #include "devices/block.h"
@@ -52,6 +53,45 @@ struct indirect_block
   };
 
 
+/* A run of LENGTH contiguous sectors of a file starting at sector START,
+   used by inodes in the extent format */
+struct inode_extent
+  {
+    block_sector_t start;               /* first sector of the run */
+    uint32_t length;                    /* number of sectors */
+  };
+
+/* number of extents stored in the inode itself, in place of the unused
+   words of the pointer format */
+#define NUMBER_INLINE_EXTENTS ((NUMBER_UNUSED_BYTES - 2) / 2)
+
+/* number of extents in an extent leaf block */
+#define NUMBER_LEAF_EXTENTS (BLOCK_SECTOR_SIZE / sizeof (struct inode_extent))
+
+/* maximal number of extents of a file: the inline ones plus the leaf
+   blocks referred to by the extent index block */
+#define MAX_EXTENTS (NUMBER_INLINE_EXTENTS \
+                     + NUMBER_INDIRECT_POINTERS * NUMBER_LEAF_EXTENTS)
+
+/* extent leaf block, spilling the extents of a fragmented file which do not
+   fit into the inode. Leaf blocks are referred to by an extent index block,
+   which is a struct indirect_block */
+struct extent_block
+  {
+    struct inode_extent extents[NUMBER_LEAF_EXTENTS];
+  };
+
+/* block map of an inode in the extent format. The file consists of the
+   extents in order, the first NUMBER_INLINE_EXTENTS of them are stored
+   inline */
+struct inode_extents
+  {
+    uint32_t cnt;                       /* number of extents */
+    block_sector_t index;               /* extent index block, 0 if none */
+    struct inode_extent inline_extents[NUMBER_INLINE_EXTENTS];
+  };
+
+
 struct bitmap;
 
 /* On-disk inode.
@@ -60,14 +100,18 @@ struct inode_disk
  {
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    bool directory;                     /* indicates if inode is a directory*/
+    uint8_t directory;                  /* 0 for a file, otherwise the
+                                           format of the directory records */
     block_sector_t parent;              /* block sector of parent */
+    /* fill level of the pointers, no longer maintained since the block map
+       may contain holes (sector 0) */
     unsigned index_level;               /* level 0 -> direct, 1->indirect,
                                            2->double-indirect */
     off_t current_index;                /* stores current index */
     off_t indirect_index;               /* indirect index */
     off_t double_indirect_index;        /* double indirect index */
-    uint32_t unused[NUMBER_UNUSED_BYTES];                /* not used */
+    struct inode_extents extents;       /* block map in the extent format,
+                                           not used otherwise */
     /* pointers to blocks with file content: */
     block_sector_t direct_pointers[NUMBER_DIRECT_BLOCKS];               
     block_sector_t indirect_pointers[NUMBER_INDIRECT_BLOCKS];               
@@ -78,27 +122,44 @@ struct inode_disk
 /* In-memory inode. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem elem;              /* Element in open_inodes. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
+    bool busy;                          /* being read in or written back,
+                                           openers have to wait */
+    struct list_elem closed_elem;       /* element in closed_inodes while
+                                           open_cnt is 0 */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
     off_t data_length;                  /* length of the file in bytes */
     off_t reader_length;                /* length of the file in bytes */
     bool directory;                     /* indicates if inode is a directory*/
+    bool old_dir_format;                /* directory with the fixed-size
+                                           entries no longer supported? */
+    bool hashed_dir;                    /* directory in the hashed format? */
     block_sector_t parent;              /* block sector of parent */
-
-    /* stores index structure information */
-    unsigned index_level;               /* level 0 -> direct, 1->indirect,
-     2->double-indirect */
-    off_t current_index;
-    off_t indirect_index;
-    off_t double_indirect_index;
+    bool dirty;                         /* metadata changed since the inode
+                                           was read or last stored? */
 
     struct lock inode_extend_lock;      /* synchronises extension of file */
     struct lock inode_directory_lock;   /* lock to synchronise removing and
                                             adding of directories */
+    off_t dir_free_hint;                /* offset of a directory below which
+                                           no record has room for an entry */
     struct lock inode_field_lock;       /* synchronies metadata */
+    bool extent_format;                 /* block map kept in extents instead
+                                           of the pointers below? */
+    struct inode_extents extents;       /* block map in the extent format */
+    block_sector_t alloc_hint;          /* sector after the last one
+                                           allocated for the inode, where
+                                           growing continues */
+
+    /* decoded copy of the indirect block byte_to_sector used last, so that
+       sequential access reads each indirect block only once */
+    struct lock block_map_lock;         /* protects the block map copy */
+    int block_map_leaf;                 /* number of the copied indirect
+                                           block in file order, -1 if none */
+    block_sector_t block_map[NUMBER_INDIRECT_POINTERS];
 
     /* pointers to blocks with file content: */
     block_sector_t direct_pointers[NUMBER_DIRECT_BLOCKS];               
@@ -107,9 +168,24 @@ struct inode
   };
 
 
+/* Sequential read-ahead state of one reader of an inode, kept per open
+   file. */
+struct inode_read_ahead
+  {
+    off_t next_pos;                     /* offset a sequential read of this
+                                           reader continues at */
+    size_t window;                      /* blocks to keep queued ahead of
+                                           the reader, 0 for random access */
+    off_t queued_end;                   /* offset up to which blocks were
+                                           already queued for read-ahead */
+  };
+
+
+/* create new inodes in the extent format instead of the pointer format */
+extern bool inode_use_extents;
+
 void inode_init (void);
 
-bool inode_allocate (struct inode_disk *inode_disk);
 void inode_deallocate (struct inode *inode);
 
 bool inode_create (block_sector_t, off_t, bool);
@@ -120,15 +196,27 @@ void inode_close (struct inode *);
 void inode_writeback (struct inode *);
 void inode_remove (struct inode *);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
+void inode_read_ahead_init (struct inode_read_ahead *);
+off_t inode_read_stream_at (struct inode *, void *, off_t size, off_t offset,
+                            struct inode_read_ahead *);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
+const void *inode_get_sector (struct inode *, off_t pos);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (struct inode *);
+off_t inode_reader_length (struct inode *);
 block_sector_t inode_parent (struct inode *);
 bool inode_set_parent_to_inode (struct inode *inode, struct inode *parent);
 bool inode_is_directory (struct inode *);
+bool inode_has_old_dir_format (struct inode *);
+void inode_set_dir_records (struct inode *);
+bool inode_has_hashed_dir_format (struct inode *);
+void inode_set_dir_hashed (struct inode *);
 bool inode_is_removed (struct inode *);
 int inode_get_open_count(struct inode*);
+#ifdef FILESYS_TEST_HOOKS
+block_sector_t inode_byte_to_sector (struct inode *, off_t pos);
+#endif
 
 
 #endif /* filesys/inode.h */
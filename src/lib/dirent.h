@@ -0,0 +1,32 @@
+#ifndef __LIB_DIRENT_H
+#define __LIB_DIRENT_H
+
+/* Directory entry records written by the getdents system call.
+   Records are packed one after another into the caller's buffer,
+   each one starting at a multiple of 4 bytes. */
+
+#include <round.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Maximum length of a file name component. */
+#define NAME_MAX 255
+
+/* Maximum characters in a filename written by readdir().  Longer
+   names are truncated, getdents() returns them in full. */
+#define READDIR_MAX_LEN 14
+
+/* A directory entry record. */
+struct dirent
+  {
+    int inumber;                /* Inode number of the entry. */
+    unsigned short reclen;      /* Bytes from this record to the next. */
+    bool is_dir;                /* Directory or ordinary file? */
+    char name[];                /* Null terminated file name. */
+  };
+
+/* Size of a record for a name of NAME_LEN characters. */
+#define DIRENT_SIZE(NAME_LEN) \
+        ROUND_UP (offsetof (struct dirent, name) + (NAME_LEN) + 1, 4)
+
+#endif /* lib/dirent.h */
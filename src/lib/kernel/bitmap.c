@@ -358,6 +358,21 @@ bitmap_write (const struct bitmap *b, struct file *file)
   off_t size = byte_cnt (b->bit_cnt);
   return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes the SIZE bytes starting at byte OFS of B's file
+   representation to the same offset in FILE, clipped to the end
+   of B.  Return true if successful, false otherwise. */
+bool
+bitmap_write_range (const struct bitmap *b, struct file *file,
+                    size_t ofs, size_t size)
+{
+  size_t file_size = byte_cnt (b->bit_cnt);
+  ASSERT (ofs <= file_size);
+  if (size > file_size - ofs)
+    size = file_size - ofs;
+  return file_write_at (file, (const uint8_t *) b->bits + ofs, size, ofs)
+         == (off_t) size;
+}
 #endif /* FILESYS */
 
 /* Debugging. */
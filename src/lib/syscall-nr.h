@@ -28,7 +28,12 @@ enum
     SYS_MKDIR,                  /* Create a directory. */
     SYS_READDIR,                /* Reads a directory entry. */
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
-    SYS_INUMBER                 /* Returns the inode number for a fd. */
+    SYS_INUMBER,                /* Returns the inode number for a fd. */
+    SYS_GETDENTS,               /* Reads many directory entries. */
+
+    /* Test hooks, only in kernels built with -DFILESYS_TEST_HOOKS. */
+    SYS_DISK_READS,             /* Counts sectors read from the disk. */
+    SYS_FILE_SECTOR             /* Returns the sector of a file offset. */
   };
 
 #endif /* lib/syscall-nr.h */
@@ -182,3 +182,21 @@ inumber (int fd)
 {
   return syscall1 (SYS_INUMBER, fd);
 }
+
+int
+getdents (int fd, void *buffer, unsigned size)
+{
+  return syscall3 (SYS_GETDENTS, fd, buffer, size);
+}
+
+int
+disk_reads (void)
+{
+  return syscall0 (SYS_DISK_READS);
+}
+
+int
+file_sector (int fd, unsigned position)
+{
+  return syscall2 (SYS_FILE_SECTOR, fd, position);
+}
@@ -3,6 +3,7 @@
 
 #include <stdbool.h>
 #include <debug.h>
+#include <dirent.h>
 
 /* Process identifier. */
 typedef int pid_t;
@@ -12,9 +13,6 @@ typedef int pid_t;
 typedef int mapid_t;
 #define MAP_FAILED ((mapid_t) -1)
 
-/* Maximum characters in a filename written by readdir(). */
-#define READDIR_MAX_LEN 14
-
 /* Typical return values from main() and arguments to exit(). */
 #define EXIT_SUCCESS 0          /* Successful execution. */
 #define EXIT_FAILURE 1          /* Unsuccessful execution. */
@@ -44,5 +42,10 @@ bool mkdir (const char *dir);
 bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
+int getdents (int fd, void *buffer, unsigned size);
+
+/* Test hooks, only in kernels built with -DFILESYS_TEST_HOOKS. */
+int disk_reads (void);
+int file_sector (int fd, unsigned position);
 
 #endif /* lib/user/syscall.h */
@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+my (%hot);
+for my $i (0...3) {
+    $hot{$i} = [random_bytes (1024)];
+}
+my ($scan) = random_bytes (160 * 512);
+my ($warm) = random_bytes (16 * 512);
+check_archive ({"hot" => \%hot, "scan" => [$scan], "warm" => [$warm]});
+pass;
@@ -0,0 +1,104 @@
+/* Makes a few small files in a directory hot by reading them
+   several times, with a smaller warm file read in between, then
+   reads a file much larger than the buffer cache sequentially.
+   The sequential pass must read most of its sectors from disk,
+   so that it overflows the cache.  Afterwards the hot files must
+   still be cached: reading them again must read fewer than half
+   of their sectors from disk.  Run with a small cache
+   (-cache=64) and the 2Q policy, under which the sequential pass
+   only replaces blocks referenced once, whereas a plain LRU
+   policy would replace every cached sector.  The disk reads are
+   counted with disk_reads(), a test hook of the kernel. */
+
+#include <random.h>
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define HOT_CNT 4
+#define HOT_SIZE 1024
+#define SCAN_SIZE (160 * 512)
+#define WARM_SIZE (16 * 512)
+
+/* data sectors of the hot files and of the scanned file */
+#define HOT_SECTORS (HOT_CNT * HOT_SIZE / 512)
+#define SCAN_SECTORS (SCAN_SIZE / 512)
+
+static char hot_buf[HOT_CNT][HOT_SIZE];
+static char scan_buf[SCAN_SIZE];
+static char warm_buf[WARM_SIZE];
+
+static void
+write_file (const char *file_name, const void *buf, size_t size)
+{
+  int fd;
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (write (fd, buf, size) == (int) size, "write \"%s\"", file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+}
+
+static void
+check_hot_files (void)
+{
+  int i;
+
+  for (i = 0; i < HOT_CNT; i++)
+    {
+      char file_name[16];
+      snprintf (file_name, sizeof file_name, "hot/%d", i);
+      check_file (file_name, hot_buf[i], HOT_SIZE);
+    }
+}
+
+void
+test_main (void)
+{
+  int reads, i;
+
+  random_init (0);
+  random_bytes (hot_buf, sizeof hot_buf);
+  random_bytes (scan_buf, sizeof scan_buf);
+  random_bytes (warm_buf, sizeof warm_buf);
+
+  CHECK (mkdir ("hot"), "mkdir \"hot\"");
+  msg ("creating hot files");
+  quiet = true;
+  for (i = 0; i < HOT_CNT; i++)
+    {
+      char file_name[16];
+      snprintf (file_name, sizeof file_name, "hot/%d", i);
+      write_file (file_name, hot_buf[i], HOT_SIZE);
+    }
+  quiet = false;
+
+  write_file ("scan", scan_buf, SCAN_SIZE);
+  write_file ("warm", warm_buf, WARM_SIZE);
+
+  /* The warm file separates the references to the hot files, so
+     that they are not taken as a single correlated reference. */
+  msg ("read hot files repeatedly");
+  quiet = true;
+  for (i = 0; i < 3; i++)
+    {
+      check_hot_files ();
+      check_file ("warm", warm_buf, WARM_SIZE);
+    }
+  quiet = false;
+
+  reads = disk_reads ();
+  check_file ("scan", scan_buf, SCAN_SIZE);
+  CHECK (disk_reads () - reads >= SCAN_SECTORS / 2,
+         "scan read mostly from disk");
+
+  msg ("read hot files after scan");
+  reads = disk_reads ();
+  quiet = true;
+  check_hot_files ();
+  quiet = false;
+  CHECK (disk_reads () - reads < HOT_SECTORS / 2,
+         "hot files mostly not read from disk again");
+}
@@ -0,0 +1,26 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(cache-scan) begin
+(cache-scan) mkdir "hot"
+(cache-scan) creating hot files
+(cache-scan) create "scan"
+(cache-scan) open "scan"
+(cache-scan) write "scan"
+(cache-scan) close "scan"
+(cache-scan) create "warm"
+(cache-scan) open "warm"
+(cache-scan) write "warm"
+(cache-scan) close "warm"
+(cache-scan) read hot files repeatedly
+(cache-scan) open "scan" for verification
+(cache-scan) verified contents of "scan"
+(cache-scan) close "scan"
+(cache-scan) scan read mostly from disk
+(cache-scan) read hot files after scan
+(cache-scan) hot files mostly not read from disk again
+(cache-scan) end
+EOF
+pass;
@@ -0,0 +1,8 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+my ($dir) = {"sub" => {}};
+$dir->{sprintf ("file-%02d", $_)} = [''] foreach 0...19;
+check_archive ({"dir" => $dir});
+pass;
@@ -0,0 +1,114 @@
+/* Creates a directory with a subdirectory and a number of files
+   and lists it with getdents() through a buffer holding only a
+   few records, so that several calls are needed.  A buffer too
+   small for the next record must fail without skipping it.
+   Every entry must be returned exactly once, with the inode
+   number of the file and only the subdirectory marked as a
+   directory. */
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 20
+
+void
+test_main (void) 
+{
+  /* room for about three records per call */
+  char buffer[3 * DIRENT_SIZE (sizeof "file-00" - 1)];
+  int inumbers[FILE_CNT];
+  bool seen[FILE_CNT];
+  bool seen_sub = false;
+  int sub_inumber;
+  int dir_fd, size, batch_cnt, entry_cnt;
+  int i;
+
+  CHECK (mkdir ("dir"), "mkdir \"dir\"");
+  CHECK (mkdir ("dir/sub"), "mkdir \"dir/sub\"");
+  CHECK ((dir_fd = open ("dir/sub")) > 1, "open \"dir/sub\"");
+  sub_inumber = inumber (dir_fd);
+  close (dir_fd);
+
+  msg ("creating files");
+  quiet = true;
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      char file_name[16];
+      int fd;
+
+      snprintf (file_name, sizeof file_name, "dir/file-%02d", i);
+      CHECK (create (file_name, 0), "create \"%s\"", file_name);
+      CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+      inumbers[i] = inumber (fd);
+      close (fd);
+      seen[i] = false;
+    }
+  quiet = false;
+
+  CHECK ((dir_fd = open ("dir")) > 1, "open \"dir\"");
+  CHECK (getdents (dir_fd, buffer, DIRENT_SIZE (0)) == -1,
+         "getdents with undersized buffer (must return -1)");
+
+  msg ("reading entries");
+  batch_cnt = entry_cnt = 0;
+  while ((size = getdents (dir_fd, buffer, sizeof buffer)) > 0)
+    {
+      const struct dirent *d;
+      int ofs;
+
+      batch_cnt++;
+      for (ofs = 0; ofs < size; ofs += d->reclen)
+        {
+          d = (const struct dirent *) (buffer + ofs);
+          if (d->reclen < DIRENT_SIZE (strlen (d->name))
+              || d->reclen % 4 != 0 || ofs + d->reclen > size)
+            fail ("bad record length %d for \"%s\"", d->reclen, d->name);
+          entry_cnt++;
+
+          if (!strcmp (d->name, "sub"))
+            {
+              if (seen_sub)
+                fail ("\"sub\" returned twice");
+              if (!d->is_dir)
+                fail ("\"sub\" not returned as a directory");
+              if (d->inumber != sub_inumber)
+                fail ("\"sub\" has inumber %d, expected %d",
+                      d->inumber, sub_inumber);
+              seen_sub = true;
+              continue;
+            }
+
+          if (strlen (d->name) != 7 || memcmp (d->name, "file-", 5)
+              || (i = atoi (d->name + 5)) < 0 || i >= FILE_CNT)
+            fail ("unexpected entry \"%s\"", d->name);
+          if (seen[i])
+            fail ("\"%s\" returned twice", d->name);
+          if (d->is_dir)
+            fail ("\"%s\" returned as a directory", d->name);
+          if (d->inumber != inumbers[i])
+            fail ("\"%s\" has inumber %d, expected %d",
+                  d->name, d->inumber, inumbers[i]);
+          seen[i] = true;
+        }
+    }
+  CHECK (size == 0, "getdents at end of directory returns 0");
+
+  if (!seen_sub)
+    fail ("\"sub\" not returned");
+  for (i = 0; i < FILE_CNT; i++)
+    if (!seen[i])
+      fail ("\"file-%02d\" not returned", i);
+  if (entry_cnt != FILE_CNT + 1)
+    fail ("%d entries returned, expected %d", entry_cnt, FILE_CNT + 1);
+  if (batch_cnt < 2)
+    fail ("all entries returned by a single call");
+  msg ("all entries returned once, in more than one call");
+
+  msg ("close \"dir\"");
+  close (dir_fd);
+}
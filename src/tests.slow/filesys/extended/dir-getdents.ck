@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(dir-getdents) begin
+(dir-getdents) mkdir "dir"
+(dir-getdents) mkdir "dir/sub"
+(dir-getdents) open "dir/sub"
+(dir-getdents) creating files
+(dir-getdents) open "dir"
+(dir-getdents) getdents with undersized buffer (must return -1)
+(dir-getdents) reading entries
+(dir-getdents) getdents at end of directory returns 0
+(dir-getdents) all entries returned once, in more than one call
+(dir-getdents) close "dir"
+(dir-getdents) end
+EOF
+pass;
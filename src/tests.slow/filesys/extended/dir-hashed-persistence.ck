@@ -0,0 +1,11 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+my ($dir) = {};
+for my $i (grep ($_ % 2, 0...149)) {
+    my ($name) = sprintf ("f%03d", $i);
+    $dir->{$name} = ["dir/$name"];
+}
+check_archive ({"dir" => $dir});
+pass;
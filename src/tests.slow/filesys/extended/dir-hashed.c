@@ -0,0 +1,90 @@
+/* Creates enough files in a directory in the hashed format
+   (-hashed-dirs) for its buckets to overflow and be split
+   several times, then checks that every file is still found
+   under its name with its own contents.  Removes every other
+   file and checks that only the others are found and listed. */
+
+#include <stdio.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 150
+
+static void
+make_name (char *file_name, size_t size, int i)
+{
+  snprintf (file_name, size, "dir/f%03d", i);
+}
+
+void
+test_main (void) 
+{
+  char file_name[16];
+  char name[READDIR_MAX_LEN + 1];
+  int dir_fd, entry_cnt;
+  int i;
+
+  CHECK (mkdir ("dir"), "mkdir \"dir\"");
+
+  msg ("creating files");
+  quiet = true;
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      int fd;
+
+      make_name (file_name, sizeof file_name, i);
+      CHECK (create (file_name, 0), "create \"%s\"", file_name);
+      CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+      CHECK (write (fd, file_name, strlen (file_name))
+             == (int) strlen (file_name), "write \"%s\"", file_name);
+      close (fd);
+    }
+  quiet = false;
+
+  msg ("checking files");
+  quiet = true;
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      make_name (file_name, sizeof file_name, i);
+      check_file (file_name, file_name, strlen (file_name));
+    }
+  quiet = false;
+
+  msg ("removing every other file");
+  quiet = true;
+  for (i = 0; i < FILE_CNT; i += 2)
+    {
+      make_name (file_name, sizeof file_name, i);
+      CHECK (remove (file_name), "remove \"%s\"", file_name);
+    }
+  quiet = false;
+
+  msg ("checking files");
+  quiet = true;
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      make_name (file_name, sizeof file_name, i);
+      if (i % 2 == 0)
+        {
+          int fd = open (file_name);
+          if (fd != -1)
+            fail ("\"%s\" opened after removal", file_name);
+        }
+      else
+        check_file (file_name, file_name, strlen (file_name));
+    }
+  quiet = false;
+
+  CHECK ((dir_fd = open ("dir")) > 1, "open \"dir\"");
+  entry_cnt = 0;
+  while (readdir (dir_fd, name))
+    entry_cnt++;
+  if (entry_cnt != FILE_CNT / 2)
+    fail ("readdir returned %d entries, expected %d",
+          entry_cnt, FILE_CNT / 2);
+  msg ("readdir returned %d entries", entry_cnt);
+  msg ("close \"dir\"");
+  close (dir_fd);
+}
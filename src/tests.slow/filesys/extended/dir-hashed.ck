@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(dir-hashed) begin
+(dir-hashed) mkdir "dir"
+(dir-hashed) creating files
+(dir-hashed) checking files
+(dir-hashed) removing every other file
+(dir-hashed) checking files
+(dir-hashed) open "dir"
+(dir-hashed) readdir returned 75 entries
+(dir-hashed) close "dir"
+(dir-hashed) end
+EOF
+pass;
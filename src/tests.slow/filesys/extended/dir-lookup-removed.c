@@ -0,0 +1,55 @@
+/* Looks up names which the kernel may have cached, after the
+   files they refer to are removed, after files are created under
+   names looked up in vain before, and after their directory is
+   removed and made again, possibly in the same sector.  Every
+   lookup must see the current directory contents. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static void
+check_open (const char *file_name, bool exists)
+{
+  int fd = open (file_name);
+
+  if (exists)
+    {
+      if (fd < 2)
+        fail ("open \"%s\" failed", file_name);
+      close (fd);
+    }
+  else if (fd != -1)
+    fail ("open \"%s\" succeeded", file_name);
+  msg ("\"%s\" %s", file_name, exists ? "found" : "not found");
+}
+
+void
+test_main (void) 
+{
+  CHECK (mkdir ("x"), "mkdir \"x\"");
+  CHECK (create ("x/f", 0), "create \"x/f\"");
+  check_open ("x/f", true);
+  CHECK (remove ("x/f"), "remove \"x/f\"");
+  check_open ("x/f", false);
+  CHECK (create ("x/f", 0), "create \"x/f\" again");
+  check_open ("x/f", true);
+
+  check_open ("x/g", false);
+  CHECK (create ("x/g", 0), "create \"x/g\"");
+  check_open ("x/g", true);
+
+  CHECK (remove ("x/f"), "remove \"x/f\"");
+  CHECK (remove ("x/g"), "remove \"x/g\"");
+  CHECK (remove ("x"), "remove \"x\"");
+  check_open ("x/g", false);
+  check_open ("x", false);
+
+  CHECK (mkdir ("x"), "mkdir \"x\" again");
+  check_open ("x/f", false);
+  check_open ("x/g", false);
+  CHECK (create ("x/h", 0), "create \"x/h\"");
+  CHECK (chdir ("x"), "chdir \"x\"");
+  check_open ("h", true);
+  check_open ("f", false);
+}
@@ -0,0 +1,31 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(dir-lookup-removed) begin
+(dir-lookup-removed) mkdir "x"
+(dir-lookup-removed) create "x/f"
+(dir-lookup-removed) "x/f" found
+(dir-lookup-removed) remove "x/f"
+(dir-lookup-removed) "x/f" not found
+(dir-lookup-removed) create "x/f" again
+(dir-lookup-removed) "x/f" found
+(dir-lookup-removed) "x/g" not found
+(dir-lookup-removed) create "x/g"
+(dir-lookup-removed) "x/g" found
+(dir-lookup-removed) remove "x/f"
+(dir-lookup-removed) remove "x/g"
+(dir-lookup-removed) remove "x"
+(dir-lookup-removed) "x/g" not found
+(dir-lookup-removed) "x" not found
+(dir-lookup-removed) mkdir "x" again
+(dir-lookup-removed) "x/f" not found
+(dir-lookup-removed) "x/g" not found
+(dir-lookup-removed) create "x/h"
+(dir-lookup-removed) chdir "x"
+(dir-lookup-removed) "h" found
+(dir-lookup-removed) "f" not found
+(dir-lookup-removed) end
+EOF
+pass;
@@ -0,0 +1,23 @@
+/* Tries to create a directory under a name that exists already,
+   then creates a file, which may get the sector of the inode
+   made for the failed mkdir.  The file must not show up as a
+   directory or with that inode's length. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  int fd;
+
+  CHECK (mkdir ("a"), "mkdir \"a\"");
+  CHECK (!mkdir ("a"), "mkdir \"a\" again (must return false)");
+  CHECK (create ("b", 512), "create \"b\"");
+  CHECK ((fd = open ("b")) > 1, "open \"b\"");
+  CHECK (!isdir (fd), "isdir \"b\" (must return false)");
+  CHECK (filesize (fd) == 512, "filesize \"b\" is 512");
+  msg ("close \"b\"");
+  close (fd);
+}
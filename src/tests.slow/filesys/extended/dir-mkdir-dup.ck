@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(dir-mkdir-dup) begin
+(dir-mkdir-dup) mkdir "a"
+(dir-mkdir-dup) mkdir "a" again (must return false)
+(dir-mkdir-dup) create "b"
+(dir-mkdir-dup) open "b"
+(dir-mkdir-dup) isdir "b" (must return false)
+(dir-mkdir-dup) filesize "b" is 512
+(dir-mkdir-dup) close "b"
+(dir-mkdir-dup) end
+EOF
+pass;
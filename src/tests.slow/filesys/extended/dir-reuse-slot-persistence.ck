@@ -0,0 +1,9 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+my ($dir) = {};
+$dir->{sprintf ("n%02d", $_)} = [''] foreach (0...9, 30...59);
+$dir->{sprintf ("longer-name-%02d", $_)} = [''] foreach 0...24;
+check_archive ({"d" => $dir});
+pass;
@@ -0,0 +1,89 @@
+/* Fills a directory, removes a run of entries in its middle and
+   adds entries with longer names, which go into the room freed
+   or behind the last entry.  Every entry must be found under its
+   name afterwards, and the removed ones must stay removed. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 60
+#define REMOVE_START 10
+#define REMOVE_CNT 20
+#define NEW_CNT 25
+
+static void
+check_open (const char *file_name, bool exists)
+{
+  int fd = open (file_name);
+
+  if (exists && fd < 2)
+    fail ("open \"%s\" failed", file_name);
+  if (!exists && fd != -1)
+    fail ("removed \"%s\" opened", file_name);
+  if (fd > 1)
+    close (fd);
+}
+
+void
+test_main (void) 
+{
+  char file_name[32];
+  char name[READDIR_MAX_LEN + 1];
+  int dir_fd, entry_cnt;
+  int i;
+
+  CHECK (mkdir ("d"), "mkdir \"d\"");
+
+  msg ("creating files");
+  quiet = true;
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (file_name, sizeof file_name, "d/n%02d", i);
+      CHECK (create (file_name, 0), "create \"%s\"", file_name);
+    }
+  quiet = false;
+
+  msg ("removing files");
+  quiet = true;
+  for (i = REMOVE_START; i < REMOVE_START + REMOVE_CNT; i++)
+    {
+      snprintf (file_name, sizeof file_name, "d/n%02d", i);
+      CHECK (remove (file_name), "remove \"%s\"", file_name);
+    }
+  quiet = false;
+
+  msg ("creating files with longer names");
+  quiet = true;
+  for (i = 0; i < NEW_CNT; i++)
+    {
+      snprintf (file_name, sizeof file_name, "d/longer-name-%02d", i);
+      CHECK (create (file_name, 0), "create \"%s\"", file_name);
+    }
+  quiet = false;
+
+  msg ("checking files");
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (file_name, sizeof file_name, "d/n%02d", i);
+      check_open (file_name,
+                  i < REMOVE_START || i >= REMOVE_START + REMOVE_CNT);
+    }
+  for (i = 0; i < NEW_CNT; i++)
+    {
+      snprintf (file_name, sizeof file_name, "d/longer-name-%02d", i);
+      check_open (file_name, true);
+    }
+
+  CHECK ((dir_fd = open ("d")) > 1, "open \"d\"");
+  entry_cnt = 0;
+  while (readdir (dir_fd, name))
+    entry_cnt++;
+  if (entry_cnt != FILE_CNT - REMOVE_CNT + NEW_CNT)
+    fail ("readdir returned %d entries, expected %d",
+          entry_cnt, FILE_CNT - REMOVE_CNT + NEW_CNT);
+  msg ("readdir returned %d entries", entry_cnt);
+  msg ("close \"d\"");
+  close (dir_fd);
+}
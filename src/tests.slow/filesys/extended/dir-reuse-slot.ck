@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(dir-reuse-slot) begin
+(dir-reuse-slot) mkdir "d"
+(dir-reuse-slot) creating files
+(dir-reuse-slot) removing files
+(dir-reuse-slot) creating files with longer names
+(dir-reuse-slot) checking files
+(dir-reuse-slot) open "d"
+(dir-reuse-slot) readdir returned 65 entries
+(dir-reuse-slot) close "d"
+(dir-reuse-slot) end
+EOF
+pass;
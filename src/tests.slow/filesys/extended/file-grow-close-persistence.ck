@@ -0,0 +1,9 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+my ($fs) = {"file" => [random_bytes (3000)]};
+$fs->{"other$_"} = [''] foreach 0...39;
+check_archive ($fs);
+pass;
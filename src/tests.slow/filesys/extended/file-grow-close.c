@@ -0,0 +1,65 @@
+/* Grows a file through one of two descriptors open on it and
+   closes both, reads it back, which closes it unchanged, and
+   grows it again.  Afterwards opens and closes enough other
+   files for the inode of the file to be dropped from memory, so
+   that reopening it reads it from disk: every growth must have
+   been written back, even though closing it unchanged may skip
+   the write. */
+
+#include <random.h>
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FIRST_SIZE 1000
+#define FILE_SIZE 3000
+
+/* more than the kernel keeps closed inodes in memory */
+#define OTHER_CNT 40
+
+static char buf[FILE_SIZE];
+
+void
+test_main (void) 
+{
+  int fd_a, fd_b, i;
+
+  random_init (0);
+  random_bytes (buf, sizeof buf);
+
+  CHECK (create ("file", 0), "create \"file\"");
+  CHECK ((fd_a = open ("file")) > 1, "open \"file\" as a");
+  CHECK ((fd_b = open ("file")) > 1, "open \"file\" as b");
+  CHECK (write (fd_a, buf, FIRST_SIZE) == FIRST_SIZE, "write through a");
+  msg ("close a");
+  close (fd_a);
+  CHECK (filesize (fd_b) == FIRST_SIZE, "size through b is %d", FIRST_SIZE);
+  msg ("close b");
+  close (fd_b);
+
+  check_file ("file", buf, FIRST_SIZE);
+
+  CHECK ((fd_a = open ("file")) > 1, "open \"file\"");
+  seek (fd_a, FIRST_SIZE);
+  CHECK (write (fd_a, buf + FIRST_SIZE, FILE_SIZE - FIRST_SIZE)
+         == FILE_SIZE - FIRST_SIZE, "write rest of \"file\"");
+  msg ("close \"file\"");
+  close (fd_a);
+
+  msg ("open and close other files");
+  quiet = true;
+  for (i = 0; i < OTHER_CNT; i++)
+    {
+      char file_name[16];
+      int fd;
+
+      snprintf (file_name, sizeof file_name, "other%d", i);
+      CHECK (create (file_name, 0), "create \"%s\"", file_name);
+      CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+      close (fd);
+    }
+  quiet = false;
+
+  check_file ("file", buf, FILE_SIZE);
+}
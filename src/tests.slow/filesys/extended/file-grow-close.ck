@@ -0,0 +1,26 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(file-grow-close) begin
+(file-grow-close) create "file"
+(file-grow-close) open "file" as a
+(file-grow-close) open "file" as b
+(file-grow-close) write through a
+(file-grow-close) close a
+(file-grow-close) size through b is 1000
+(file-grow-close) close b
+(file-grow-close) open "file" for verification
+(file-grow-close) verified contents of "file"
+(file-grow-close) close "file"
+(file-grow-close) open "file"
+(file-grow-close) write rest of "file"
+(file-grow-close) close "file"
+(file-grow-close) open and close other files
+(file-grow-close) open "file" for verification
+(file-grow-close) verified contents of "file"
+(file-grow-close) close "file"
+(file-grow-close) end
+EOF
+pass;
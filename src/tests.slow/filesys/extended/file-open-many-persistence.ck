@@ -0,0 +1,8 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+my ($fs);
+$fs->{"file$_"} = [pack ("V", $_)] foreach 0...29;
+check_archive ($fs);
+pass;
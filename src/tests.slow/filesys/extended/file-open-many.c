@@ -0,0 +1,69 @@
+/* Keeps many files open at once, each of them twice.  Opening a
+   file again must return its inode, with the same inode number
+   and contents, and different files must not share one. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 30
+
+static void
+make_name (char *file_name, size_t size, int i)
+{
+  snprintf (file_name, size, "file%d", i);
+}
+
+void
+test_main (void) 
+{
+  char file_name[16];
+  int fds[FILE_CNT][2];
+  int i, j;
+
+  msg ("creating files");
+  quiet = true;
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      int fd;
+
+      make_name (file_name, sizeof file_name, i);
+      CHECK (create (file_name, 0), "create \"%s\"", file_name);
+      CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+      CHECK (write (fd, &i, sizeof i) == sizeof i, "write \"%s\"", file_name);
+      close (fd);
+    }
+  quiet = false;
+
+  msg ("opening every file twice");
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      make_name (file_name, sizeof file_name, i);
+      for (j = 0; j < 2; j++)
+        if ((fds[i][j] = open (file_name)) < 2)
+          fail ("open \"%s\" failed", file_name);
+      if (inumber (fds[i][0]) != inumber (fds[i][1]))
+        fail ("\"%s\" opened with inumbers %d and %d", file_name,
+              inumber (fds[i][0]), inumber (fds[i][1]));
+      for (j = 0; j < i; j++)
+        if (inumber (fds[j][0]) == inumber (fds[i][0]))
+          fail ("file%d and \"%s\" have inumber %d", j, file_name,
+                inumber (fds[i][0]));
+    }
+
+  msg ("reading every file through both descriptors");
+  for (i = 0; i < FILE_CNT; i++)
+    for (j = 0; j < 2; j++)
+      {
+        int value;
+        if (read (fds[i][j], &value, sizeof value) != sizeof value
+            || value != i)
+          fail ("file%d does not contain %d", i, i);
+      }
+
+  msg ("closing files");
+  for (i = 0; i < FILE_CNT; i++)
+    for (j = 0; j < 2; j++)
+      close (fds[i][j]);
+}
@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(file-open-many) begin
+(file-open-many) creating files
+(file-open-many) opening every file twice
+(file-open-many) reading every file through both descriptors
+(file-open-many) closing files
+(file-open-many) end
+EOF
+pass;
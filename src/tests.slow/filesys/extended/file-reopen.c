@@ -0,0 +1,71 @@
+/* Reopens files after closing them, which finds their inodes
+   among the recently closed ones, and after removing them.  A
+   removed file stays readable through a descriptor open on it
+   but cannot be opened by name, and new files, which may get
+   its sectors once it is closed, must start empty. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE 1234
+
+static char buf_a[FILE_SIZE];
+static char buf_b[FILE_SIZE];
+
+static void
+write_file (const char *file_name, const char *buf)
+{
+  int fd;
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (write (fd, buf, FILE_SIZE) == FILE_SIZE, "write \"%s\"", file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+}
+
+static void
+check_empty (const char *file_name)
+{
+  int fd;
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (filesize (fd) == 0, "\"%s\" is empty", file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+}
+
+void
+test_main (void) 
+{
+  int fd;
+
+  random_init (0);
+  random_bytes (buf_a, sizeof buf_a);
+  random_bytes (buf_b, sizeof buf_b);
+
+  /* reopen after close */
+  write_file ("a", buf_a);
+  check_file ("a", buf_a, FILE_SIZE);
+  check_file ("a", buf_a, FILE_SIZE);
+
+  /* reopen after remove, with the file still open */
+  CHECK ((fd = open ("a")) > 1, "open \"a\"");
+  CHECK (remove ("a"), "remove \"a\"");
+  CHECK (open ("a") == -1, "open \"a\" after remove (must return -1)");
+  check_file_handle (fd, "a", buf_a, FILE_SIZE);
+  check_empty ("a");
+  msg ("close removed \"a\"");
+  close (fd);
+  check_empty ("c");
+
+  /* remove a closed file, then create files in its sectors */
+  write_file ("b", buf_b);
+  CHECK (remove ("b"), "remove \"b\"");
+  CHECK (open ("b") == -1, "open \"b\" after remove (must return -1)");
+  check_empty ("b");
+  check_empty ("d");
+}
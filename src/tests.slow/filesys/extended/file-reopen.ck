@@ -0,0 +1,46 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(file-reopen) begin
+(file-reopen) create "a"
+(file-reopen) open "a"
+(file-reopen) write "a"
+(file-reopen) close "a"
+(file-reopen) open "a" for verification
+(file-reopen) verified contents of "a"
+(file-reopen) close "a"
+(file-reopen) open "a" for verification
+(file-reopen) verified contents of "a"
+(file-reopen) close "a"
+(file-reopen) open "a"
+(file-reopen) remove "a"
+(file-reopen) open "a" after remove (must return -1)
+(file-reopen) verified contents of "a"
+(file-reopen) create "a"
+(file-reopen) open "a"
+(file-reopen) "a" is empty
+(file-reopen) close "a"
+(file-reopen) close removed "a"
+(file-reopen) create "c"
+(file-reopen) open "c"
+(file-reopen) "c" is empty
+(file-reopen) close "c"
+(file-reopen) create "b"
+(file-reopen) open "b"
+(file-reopen) write "b"
+(file-reopen) close "b"
+(file-reopen) remove "b"
+(file-reopen) open "b" after remove (must return -1)
+(file-reopen) create "b"
+(file-reopen) open "b"
+(file-reopen) "b" is empty
+(file-reopen) close "b"
+(file-reopen) create "d"
+(file-reopen) open "d"
+(file-reopen) "d" is empty
+(file-reopen) close "d"
+(file-reopen) end
+EOF
+pass;
@@ -0,0 +1,73 @@
+/* Grows one file by a single large write and another one a
+   sector at a time, then checks with the file_sector() test hook
+   of the kernel that the data sectors of each file follow each
+   other on disk.  Only the indirect blocks taken from the same
+   runs may break the sequence. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define BLOCK_SIZE 512
+#define BLOCK_CNT 100
+#define FILE_SIZE (BLOCK_CNT * BLOCK_SIZE)
+
+/* breaks of the sequence allowed, well above the indirect blocks of a
+   file of BLOCK_CNT sectors */
+#define MAX_BREAKS (BLOCK_CNT / 32)
+
+static char buf[FILE_SIZE];
+
+static void
+check_contiguous (const char *file_name)
+{
+  int fd, block, breaks = 0;
+  int prev = -1;
+
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  for (block = 0; block < BLOCK_CNT; block++)
+    {
+      int sector = file_sector (fd, block * BLOCK_SIZE);
+      if (sector == 0 || sector == -1)
+        fail ("block %d of \"%s\" has no sector", block, file_name);
+      if (prev != -1 && sector != prev + 1)
+        breaks++;
+      prev = sector;
+    }
+  if (breaks > MAX_BREAKS)
+    fail ("sectors of \"%s\" not contiguous: %d breaks", file_name, breaks);
+  msg ("sectors of \"%s\" contiguous", file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+}
+
+void
+test_main (void) 
+{
+  int fd, block;
+
+  random_init (0);
+  random_bytes (buf, sizeof buf);
+
+  CHECK (create ("a", 0), "create \"a\"");
+  CHECK (create ("b", 0), "create \"b\"");
+
+  CHECK ((fd = open ("a")) > 1, "open \"a\"");
+  CHECK (write (fd, buf, FILE_SIZE) == FILE_SIZE, "write \"a\"");
+  msg ("close \"a\"");
+  close (fd);
+
+  CHECK ((fd = open ("b")) > 1, "open \"b\"");
+  msg ("append to \"b\" a sector at a time");
+  for (block = 0; block < BLOCK_CNT; block++)
+    if (write (fd, buf + block * BLOCK_SIZE, BLOCK_SIZE) != BLOCK_SIZE)
+      fail ("write block %d of \"b\" failed", block);
+  msg ("close \"b\"");
+  close (fd);
+
+  check_contiguous ("a");
+  check_contiguous ("b");
+  check_file ("a", buf, FILE_SIZE);
+  check_file ("b", buf, FILE_SIZE);
+}
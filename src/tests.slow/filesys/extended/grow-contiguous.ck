@@ -0,0 +1,29 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-contiguous) begin
+(grow-contiguous) create "a"
+(grow-contiguous) create "b"
+(grow-contiguous) open "a"
+(grow-contiguous) write "a"
+(grow-contiguous) close "a"
+(grow-contiguous) open "b"
+(grow-contiguous) append to "b" a sector at a time
+(grow-contiguous) close "b"
+(grow-contiguous) open "a"
+(grow-contiguous) sectors of "a" contiguous
+(grow-contiguous) close "a"
+(grow-contiguous) open "b"
+(grow-contiguous) sectors of "b" contiguous
+(grow-contiguous) close "b"
+(grow-contiguous) open "a" for verification
+(grow-contiguous) verified contents of "a"
+(grow-contiguous) close "a"
+(grow-contiguous) open "b" for verification
+(grow-contiguous) verified contents of "b"
+(grow-contiguous) close "b"
+(grow-contiguous) end
+EOF
+pass;
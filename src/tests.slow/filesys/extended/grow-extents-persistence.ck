@@ -0,0 +1,9 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+my ($a) = ("\0" x 20000) . "x";
+my ($b) = random_bytes (23456);
+check_archive ({"a" => [$a], "b" => [$b]});
+pass;
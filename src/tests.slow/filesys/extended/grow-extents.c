@@ -0,0 +1,54 @@
+/* Creates files in the extent format (-extents): one with an
+   initial size that is then extended by writing past its end,
+   and one grown sequentially by writes of varying size.  Checks
+   that their contents are correct. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define INITIAL_SIZE 5000
+#define SPARSE_SIZE 20001
+#define SEQ_SIZE 23456
+
+static char sparse_buf[SPARSE_SIZE];
+static char seq_buf[SEQ_SIZE];
+
+void
+test_main (void) 
+{
+  size_t ofs;
+  int fd;
+
+  random_init (0);
+  random_bytes (seq_buf, sizeof seq_buf);
+
+  CHECK (create ("a", INITIAL_SIZE), "create \"a\"");
+  CHECK ((fd = open ("a")) > 1, "open \"a\"");
+  msg ("seek \"a\"");
+  seek (fd, SPARSE_SIZE - 1);
+  sparse_buf[SPARSE_SIZE - 1] = 'x';
+  CHECK (write (fd, &sparse_buf[SPARSE_SIZE - 1], 1) == 1, "write \"a\"");
+  msg ("close \"a\"");
+  close (fd);
+
+  CHECK (create ("b", 0), "create \"b\"");
+  CHECK ((fd = open ("b")) > 1, "open \"b\"");
+  msg ("write \"b\"");
+  for (ofs = 0; ofs < SEQ_SIZE; )
+    {
+      size_t block_size = random_ulong () % 1500 + 1;
+      if (block_size > SEQ_SIZE - ofs)
+        block_size = SEQ_SIZE - ofs;
+      if (write (fd, seq_buf + ofs, block_size) != (int) block_size)
+        fail ("write %zu bytes at offset %zu in \"b\" failed",
+              block_size, ofs);
+      ofs += block_size;
+    }
+  msg ("close \"b\"");
+  close (fd);
+
+  check_file ("a", sparse_buf, SPARSE_SIZE);
+  check_file ("b", seq_buf, SEQ_SIZE);
+}
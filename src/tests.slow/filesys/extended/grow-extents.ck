@@ -0,0 +1,24 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-extents) begin
+(grow-extents) create "a"
+(grow-extents) open "a"
+(grow-extents) seek "a"
+(grow-extents) write "a"
+(grow-extents) close "a"
+(grow-extents) create "b"
+(grow-extents) open "b"
+(grow-extents) write "b"
+(grow-extents) close "b"
+(grow-extents) open "a" for verification
+(grow-extents) verified contents of "a"
+(grow-extents) close "a"
+(grow-extents) open "b" for verification
+(grow-extents) verified contents of "b"
+(grow-extents) close "b"
+(grow-extents) end
+EOF
+pass;
@@ -0,0 +1,58 @@
+/* Grows two files in the extent format (-extents) by appending
+   a sector at a time to each in turn, so that their sectors
+   interleave on disk and each file consists of many short
+   extents, more than fit into the inode.  Checks that their
+   contents are correct. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+/* more sectors than extents fit into the inode */
+#define BLOCK_SIZE 512
+#define BLOCK_CNT 120
+#define FILE_SIZE (BLOCK_CNT * BLOCK_SIZE)
+
+static char buf_a[FILE_SIZE];
+static char buf_b[FILE_SIZE];
+
+static void
+append_block (const char *file_name, int fd, const char *buf, int block)
+{
+  if (write (fd, buf + block * BLOCK_SIZE, BLOCK_SIZE) != BLOCK_SIZE)
+    fail ("write block %d of \"%s\" failed", block, file_name);
+}
+
+void
+test_main (void) 
+{
+  int fd_a, fd_b;
+  int block;
+
+  random_init (0);
+  random_bytes (buf_a, sizeof buf_a);
+  random_bytes (buf_b, sizeof buf_b);
+
+  CHECK (create ("a", 0), "create \"a\"");
+  CHECK (create ("b", 0), "create \"b\"");
+
+  CHECK ((fd_a = open ("a")) > 1, "open \"a\"");
+  CHECK ((fd_b = open ("b")) > 1, "open \"b\"");
+
+  msg ("append to \"a\" and \"b\" alternately");
+  for (block = 0; block < BLOCK_CNT; block++)
+    {
+      append_block ("a", fd_a, buf_a, block);
+      append_block ("b", fd_b, buf_b, block);
+    }
+
+  msg ("close \"a\"");
+  close (fd_a);
+
+  msg ("close \"b\"");
+  close (fd_b);
+
+  check_file ("a", buf_a, FILE_SIZE);
+  check_file ("b", buf_b, FILE_SIZE);
+}
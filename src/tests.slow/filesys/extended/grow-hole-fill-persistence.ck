@@ -0,0 +1,10 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+my ($sparse) = "\0" x (300 * 512);
+substr ($sparse, $_ * 512, 512) = random_bytes (512)
+  foreach (20, 21, 100, 200, 201);
+check_archive ({"sparse" => [$sparse]});
+pass;
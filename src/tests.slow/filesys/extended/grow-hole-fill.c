@@ -0,0 +1,75 @@
+/* Reads holes in the indirect blocks of a sparse file through one
+   file descriptor, fills them through a second one, and reads
+   them again through the first.  The data written must be read,
+   not the zeros of the holes seen before. */
+
+#include <random.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define BLOCK_SIZE 512
+#define BLOCK_CNT 300
+#define FILE_SIZE (BLOCK_CNT * BLOCK_SIZE)
+
+/* blocks filled, in the first and second indirect block */
+static const int filled[] = { 20, 21, 100, 200, 201 };
+#define FILLED_CNT (int) (sizeof filled / sizeof *filled)
+
+static char buf[FILE_SIZE];
+static char zeros[BLOCK_SIZE];
+
+/* reads the filled blocks through FD and compares them with the
+   same blocks of EXPECTED */
+static void
+read_filled (int fd, const char *expected, size_t stride)
+{
+  char block[BLOCK_SIZE];
+  int i;
+
+  for (i = 0; i < FILLED_CNT; i++)
+    {
+      seek (fd, filled[i] * BLOCK_SIZE);
+      if (read (fd, block, BLOCK_SIZE) != BLOCK_SIZE)
+        fail ("read block %d failed", filled[i]);
+      if (memcmp (block, expected + filled[i] * stride, BLOCK_SIZE))
+        fail ("block %d differs from expected data", filled[i]);
+    }
+}
+
+void
+test_main (void) 
+{
+  int fd_read, fd_write, i;
+
+  random_init (0);
+  for (i = 0; i < FILLED_CNT; i++)
+    random_bytes (buf + filled[i] * BLOCK_SIZE, BLOCK_SIZE);
+
+  CHECK (create ("sparse", FILE_SIZE), "create \"sparse\"");
+  CHECK ((fd_read = open ("sparse")) > 1, "open \"sparse\" for reading");
+  CHECK ((fd_write = open ("sparse")) > 1, "open \"sparse\" for writing");
+
+  msg ("read holes");
+  read_filled (fd_read, zeros, 0);
+
+  msg ("fill holes");
+  for (i = 0; i < FILLED_CNT; i++)
+    {
+      int ofs = filled[i] * BLOCK_SIZE;
+
+      seek (fd_write, ofs);
+      if (write (fd_write, buf + ofs, BLOCK_SIZE) != BLOCK_SIZE)
+        fail ("write block %d failed", filled[i]);
+    }
+
+  msg ("read filled holes");
+  read_filled (fd_read, buf, BLOCK_SIZE);
+
+  msg ("close \"sparse\"");
+  close (fd_write);
+  close (fd_read);
+
+  check_file ("sparse", buf, FILE_SIZE);
+}
@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-hole-fill) begin
+(grow-hole-fill) create "sparse"
+(grow-hole-fill) open "sparse" for reading
+(grow-hole-fill) open "sparse" for writing
+(grow-hole-fill) read holes
+(grow-hole-fill) fill holes
+(grow-hole-fill) read filled holes
+(grow-hole-fill) close "sparse"
+(grow-hole-fill) open "sparse" for verification
+(grow-hole-fill) verified contents of "sparse"
+(grow-hole-fill) close "sparse"
+(grow-hole-fill) end
+EOF
+pass;
@@ -0,0 +1,9 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+my ($sparse) = "\0" x (151 * 512);
+substr ($sparse, $_ * 512, 512) = random_bytes (512) foreach (0, 5, 40, 150);
+check_archive ({"sparse" => [$sparse], "empty" => ["\0" x 40000]});
+pass;
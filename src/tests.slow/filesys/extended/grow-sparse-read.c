@@ -0,0 +1,93 @@
+/* Writes a few sectors of a file far apart, in its direct and
+   indirect blocks, and creates a second file with an initial
+   size but no data.  Reads both back, the gaps must read as
+   zeros.  Checks with the file_sector() test hook of the kernel
+   that only the written sectors got a block on disk, reading the
+   gaps must not allocate them. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define BLOCK_SIZE 512
+#define BLOCK_CNT 151
+#define FILE_SIZE (BLOCK_CNT * BLOCK_SIZE)
+#define EMPTY_SIZE 40000
+
+/* blocks written: direct ones and ones in the first and second
+   indirect block */
+static const int written[] = { 0, 5, 40, 150 };
+#define WRITTEN_CNT (int) (sizeof written / sizeof *written)
+
+static char buf[FILE_SIZE];
+static char zeros[EMPTY_SIZE];
+
+static bool
+is_written (int block)
+{
+  int i;
+
+  for (i = 0; i < WRITTEN_CNT; i++)
+    if (written[i] == block)
+      return true;
+  return false;
+}
+
+static void
+check_holes (const char *file_name, int block_cnt)
+{
+  int fd, block;
+
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  for (block = 0; block < block_cnt; block++)
+    {
+      int sector = file_sector (fd, block * BLOCK_SIZE);
+      if (sector == -1)
+        fail ("block %d of \"%s\" past its end", block, file_name);
+      if (is_written (block) && sector == 0)
+        fail ("written block %d of \"%s\" has no sector", block, file_name);
+      if (!is_written (block) && sector != 0)
+        fail ("hole at block %d of \"%s\" has a sector", block, file_name);
+    }
+  msg ("only written blocks of \"%s\" allocated", file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+}
+
+void
+test_main (void) 
+{
+  int fd, i;
+
+  random_init (0);
+  for (i = 0; i < WRITTEN_CNT; i++)
+    random_bytes (buf + written[i] * BLOCK_SIZE, BLOCK_SIZE);
+
+  CHECK (create ("sparse", 0), "create \"sparse\"");
+  CHECK ((fd = open ("sparse")) > 1, "open \"sparse\"");
+  msg ("write blocks of \"sparse\" far apart");
+  for (i = WRITTEN_CNT - 1; i >= 0; i--)
+    {
+      seek (fd, written[i] * BLOCK_SIZE);
+      if (write (fd, buf + written[i] * BLOCK_SIZE, BLOCK_SIZE) != BLOCK_SIZE)
+        fail ("write block %d of \"sparse\" failed", written[i]);
+    }
+  msg ("close \"sparse\"");
+  close (fd);
+
+  CHECK (create ("empty", EMPTY_SIZE), "create \"empty\"");
+
+  check_file ("sparse", buf, FILE_SIZE);
+  check_file ("empty", zeros, EMPTY_SIZE);
+  check_holes ("sparse", BLOCK_CNT);
+
+  /* no block of "empty" is written */
+  CHECK ((fd = open ("empty")) > 1, "open \"empty\"");
+  for (i = 0; i * BLOCK_SIZE < EMPTY_SIZE; i++)
+    if (file_sector (fd, i * BLOCK_SIZE) != 0)
+      fail ("hole at block %d of \"empty\" has a sector", i);
+  msg ("no block of \"empty\" allocated");
+  msg ("close \"empty\"");
+  close (fd);
+}
@@ -0,0 +1,26 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-sparse-read) begin
+(grow-sparse-read) create "sparse"
+(grow-sparse-read) open "sparse"
+(grow-sparse-read) write blocks of "sparse" far apart
+(grow-sparse-read) close "sparse"
+(grow-sparse-read) create "empty"
+(grow-sparse-read) open "sparse" for verification
+(grow-sparse-read) verified contents of "sparse"
+(grow-sparse-read) close "sparse"
+(grow-sparse-read) open "empty" for verification
+(grow-sparse-read) verified contents of "empty"
+(grow-sparse-read) close "empty"
+(grow-sparse-read) open "sparse"
+(grow-sparse-read) only written blocks of "sparse" allocated
+(grow-sparse-read) close "sparse"
+(grow-sparse-read) open "empty"
+(grow-sparse-read) no block of "empty" allocated
+(grow-sparse-read) close "empty"
+(grow-sparse-read) end
+EOF
+pass;
@@ -36,6 +36,9 @@
 #include "devices/ide.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
+#include "filesys/cache.h"
+#include "filesys/directory.h"
+#include "filesys/inode.h"
 #endif
 
 /* Page directory with kernel mappings only. */
@@ -247,6 +250,20 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-cache"))
+        {
+          int sectors = atoi (value);
+          if (sectors <= 0)
+            PANIC ("-cache needs a positive number of sectors, not `%s'",
+                   value);
+          filesys_cache_size = sectors;
+        }
+      else if (!strcmp (name, "-cache-policy"))
+        filesys_cache_policy_name = value;
+      else if (!strcmp (name, "-extents"))
+        inode_use_extents = true;
+      else if (!strcmp (name, "-hashed-dirs"))
+        dir_use_hashed = true;
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
@@ -373,6 +390,11 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -cache=SECTORS     Cache up to SECTORS disk sectors in memory,\n"
+          "                     at most half of the free kernel pages.\n"
+          "  -cache-policy=NAME Use cache replacement policy NAME (2q, clock).\n"
+          "  -extents           Create new files in the extent inode format.\n"
+          "  -hashed-dirs       Create new directories in the hashed format.\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
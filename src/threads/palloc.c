@@ -141,6 +141,21 @@ palloc_free_multiple (void *pages, size_t page_cnt)
   bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
 }
 
+/* Returns the number of free pages in the user pool if PAL_USER
+   is set in FLAGS, otherwise in the kernel pool.  The free pages
+   need not be contiguous. */
+size_t
+palloc_free_cnt (enum palloc_flags flags)
+{
+  struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+  size_t cnt;
+
+  lock_acquire (&pool->lock);
+  cnt = bitmap_count (pool->used_map, 0, bitmap_size (pool->used_map), false);
+  lock_release (&pool->lock);
+  return cnt;
+}
+
 /* Frees the page at PAGE. */
 void
 palloc_free_page (void *page) 
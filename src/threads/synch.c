@@ -336,3 +336,102 @@ cond_broadcast (struct condition *cond, struct lock *lock)
   while (!list_empty (&cond->waiters))
     cond_signal (cond, lock);
 }
+
+/* Initializes RW_LOCK.  A readers-writer lock can be held by
+   any number of readers at once ("shared") or by a single writer
+   ("exclusive"), but never by readers and a writer at the same
+   time. */
+void
+rw_lock_init (struct rw_lock *rw_lock)
+{
+  ASSERT (rw_lock != NULL);
+
+  lock_init (&rw_lock->lock);
+  cond_init (&rw_lock->readers_ok);
+  cond_init (&rw_lock->writer_ok);
+  rw_lock->reader_cnt = 0;
+  rw_lock->waiting_writer_cnt = 0;
+  rw_lock->writer = NULL;
+}
+
+/* Acquires RW_LOCK for reading, sleeping while a writer holds
+   it or waits for it.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rw_lock_acquire_shared (struct rw_lock *rw_lock)
+{
+  ASSERT (rw_lock != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (rw_lock->writer != thread_current ());
+
+  lock_acquire (&rw_lock->lock);
+  while (rw_lock->writer != NULL || rw_lock->waiting_writer_cnt > 0)
+    cond_wait (&rw_lock->readers_ok, &rw_lock->lock);
+  rw_lock->reader_cnt++;
+  lock_release (&rw_lock->lock);
+}
+
+/* Releases RW_LOCK, which the current thread must hold for
+   reading.  The last reader lets a waiting writer in. */
+void
+rw_lock_release_shared (struct rw_lock *rw_lock)
+{
+  ASSERT (rw_lock != NULL);
+
+  lock_acquire (&rw_lock->lock);
+  ASSERT (rw_lock->reader_cnt > 0);
+  if (--rw_lock->reader_cnt == 0)
+    cond_signal (&rw_lock->writer_ok, &rw_lock->lock);
+  lock_release (&rw_lock->lock);
+}
+
+/* Acquires RW_LOCK for writing, sleeping until no reader and no
+   other writer holds it.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rw_lock_acquire_exclusive (struct rw_lock *rw_lock)
+{
+  ASSERT (rw_lock != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (rw_lock->writer != thread_current ());
+
+  lock_acquire (&rw_lock->lock);
+  rw_lock->waiting_writer_cnt++;
+  while (rw_lock->writer != NULL || rw_lock->reader_cnt > 0)
+    cond_wait (&rw_lock->writer_ok, &rw_lock->lock);
+  rw_lock->waiting_writer_cnt--;
+  rw_lock->writer = thread_current ();
+  lock_release (&rw_lock->lock);
+}
+
+/* Releases RW_LOCK, which the current thread must hold for
+   writing.  Waiting writers go first, otherwise all waiting
+   readers are let in. */
+void
+rw_lock_release_exclusive (struct rw_lock *rw_lock)
+{
+  ASSERT (rw_lock != NULL);
+  ASSERT (rw_lock_held_exclusive_by_current_thread (rw_lock));
+
+  lock_acquire (&rw_lock->lock);
+  rw_lock->writer = NULL;
+  if (rw_lock->waiting_writer_cnt > 0)
+    cond_signal (&rw_lock->writer_ok, &rw_lock->lock);
+  else
+    cond_broadcast (&rw_lock->readers_ok, &rw_lock->lock);
+  lock_release (&rw_lock->lock);
+}
+
+/* Returns true if the current thread holds RW_LOCK for writing,
+   false otherwise. */
+bool
+rw_lock_held_exclusive_by_current_thread (const struct rw_lock *rw_lock)
+{
+  ASSERT (rw_lock != NULL);
+
+  return rw_lock->writer == thread_current ();
+}
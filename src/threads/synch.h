@@ -41,6 +41,27 @@ void cond_wait (struct condition *, struct lock *);
 void cond_signal (struct condition *, struct lock *);
 void cond_broadcast (struct condition *, struct lock *);
 
+/* Readers-writer lock.
+   Any number of readers may hold the lock shared at the same
+   time, a writer holds it exclusively.  Waiting writers are
+   preferred over new readers so that writers do not starve. */
+struct rw_lock
+  {
+    struct lock lock;               /* Protects the members below. */
+    struct condition readers_ok;    /* Signaled when readers may enter. */
+    struct condition writer_ok;     /* Signaled when a writer may enter. */
+    unsigned reader_cnt;            /* Number of readers holding the lock. */
+    unsigned waiting_writer_cnt;    /* Number of writers waiting. */
+    struct thread *writer;          /* Writer holding the lock, if any. */
+  };
+
+void rw_lock_init (struct rw_lock *);
+void rw_lock_acquire_shared (struct rw_lock *);
+void rw_lock_release_shared (struct rw_lock *);
+void rw_lock_acquire_exclusive (struct rw_lock *);
+void rw_lock_release_exclusive (struct rw_lock *);
+bool rw_lock_held_exclusive_by_current_thread (const struct rw_lock *);
+
 /* Optimization barrier.
 
    The compiler will not reorder operations across an
@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include "lib/string.h"
 #include <syscall-nr.h>
+#include <dirent.h>
 #include "threads/interrupt.h"
 #include "threads/vaddr.h"
 #include "threads/thread.h"
@@ -45,6 +46,11 @@ bool syscall_chdir(const char *name);
 bool syscall_readdir(int fd, char *dir_name);
 bool syscall_isdir(int fd);
 int syscall_inumber(int fd);
+int syscall_getdents(int fd, void *buffer, unsigned size);
+#ifdef FILESYS_TEST_HOOKS
+int syscall_disk_reads(void);
+int syscall_file_sector(int fd, unsigned position);
+#endif
 
 
 void
@@ -219,6 +225,31 @@ syscall_handler (struct intr_frame *f UNUSED)
         break;
       }
 
+    case SYS_GETDENTS:
+      {
+        int fd = *((int*)read_argument_at_index(f,0)); 
+        void *buffer = *((void**)read_argument_at_index(f,sizeof(int))); 
+        unsigned size = *((unsigned*)read_argument_at_index(f,2*sizeof(int))); 
+        f->eax = syscall_getdents(fd, buffer, size);
+        break;
+      }
+
+#ifdef FILESYS_TEST_HOOKS
+    case SYS_DISK_READS:
+      {
+        f->eax = syscall_disk_reads();
+        break;
+      }
+
+    case SYS_FILE_SECTOR:
+      {
+        int fd = *((int*)read_argument_at_index(f,0)); 
+        unsigned position = *((unsigned*)read_argument_at_index(f,sizeof(int))); 
+        f->eax = syscall_file_sector(fd, position);
+        break;
+      }
+#endif
+
     default:
       {
         syscall_exit(-1);
@@ -629,10 +660,12 @@ bool syscall_mkdir(const char *dir_name)
 }
 
 /* Reads a directory entry from file descriptor fd 
-   stores the file name inside dir name. */
+   stores the file name inside dir name, truncated to READDIR_MAX_LEN
+   characters. */
 bool
 syscall_readdir(int fd, char *name)
 {
+  char *entry_name = NULL;
   bool success = false;
   struct file_entry *file_entry = get_file_entry(fd);
   if (file_entry == NULL || file_entry->dir == NULL)
@@ -643,12 +676,69 @@ syscall_readdir(int fd, char *name)
   if (inode == NULL || !inode_is_directory(inode) || inode_is_removed(inode))
     goto done;
 
-  success = dir_readdir(dir, name);
+  /* Names may be up to NAME_MAX characters, too much for the
+     kernel stack. */
+  entry_name = malloc(NAME_MAX + 1);
+  if (entry_name == NULL)
+    goto done;
+
+  success = dir_readdir(dir, entry_name);
+  if (success)
+    strlcpy(name, entry_name, READDIR_MAX_LEN + 1);
 
  done:
+  free(entry_name);
   return success;
 }
 
+/* Reads as many directory entries from file descriptor fd as fit into
+   buffer of size bytes, see dir_getdents. Returns the number of bytes
+   written, 0 at the end of the directory, -1 on failure. */
+int
+syscall_getdents(int fd, void *buffer, unsigned size)
+{
+  int returnvalue = -1;
+
+  /* check if the entire buffer is valid */
+  validate_buffer(buffer, size);
+
+  struct file_entry *file_entry = get_file_entry(fd);
+  if (file_entry == NULL || file_entry->dir == NULL)
+    goto done;
+
+  struct dir *dir = file_entry->dir;
+  struct inode *inode = dir_get_inode(dir);
+  if (inode == NULL || !inode_is_directory(inode) || inode_is_removed(inode))
+    goto done;
+
+  returnvalue = dir_getdents(dir, buffer, size);
+
+ done:
+  return returnvalue;
+}
+
+#ifdef FILESYS_TEST_HOOKS
+/* returns the number of sectors read from the file system device so far,
+   which lets tests observe whether the buffer cache kept a sector */
+int
+syscall_disk_reads(void)
+{
+  return block_read_cnt(fs_device);
+}
+
+/* returns the sector holding byte offset position of the file open as fd,
+   0 if it lies in a hole, or -1 if fd is no open file or position is not
+   below its length, which lets tests check the layout of a file on disk */
+int
+syscall_file_sector(int fd, unsigned position)
+{
+  struct file* file = get_file(fd);
+  if (file == NULL || position >= (unsigned) file_length(file))
+    return -1;
+  return inode_byte_to_sector(file_get_inode(file), position);
+}
+#endif
+
 /* returns true if fd belongs to an directory, false otherwise */
 bool
 syscall_isdir(int fd)